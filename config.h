@@ -3,6 +3,19 @@
 
 #define WIDTH  128
 #define HEIGHT 64
+#define CHAINS 1           // 2: the left and right half of WIDTH are driven as two chains in parallel
+#define CHAIN2_DATA_PIN 0  // CHAINS 2: first of 6 consecutive free GPIOs for R0 G0 B0 R1 G1 B1 of the second chain
+#define CHAIN2_CLK_PIN 0   // CHAINS 2: and a free GPIO for its clock
+
+#define SKIP_EMPTY_ROWS 0          // 1: leave unlit bit plane rows out of the scan, for a faster refresh (see Hub75::set_skip_empty())
+                                   // brightness then depends on the content: the fewer rows and planes are lit, the brighter they
+                                   // get, up to the number of row pairs times for a single lit row pair; colours within a frame stay right
+
+#define DISPLAY_IRQ_CORE 1         // core that handles DMA_IRQ_0 (the scan-out interrupt), 0 or 1
+
+#define INGEST_RING_SIZE (32 * 1024) // receive buffer between lwIP and the frame processing, a power of 2
+#define INGEST_POLICY INGEST_LATEST  // what to do with frames coming in faster than they are shown, see ingest.h
+#define INGEST_QUEUE_FRAMES 2        // N for INGEST_QUEUE
 
 #define BROKER_HOST "192.168.4.8"
 #define BROKER_PORT 1883
@@ -10,6 +23,11 @@
 #define TOPIC_ALL  "all/#"         // <== This is what we subscribe to for msgs to all boards
 #define TOPIC_BRD  "id%d/#"         // <== This is what we subscribe to for each individual board ID
 
+#define UDP_FRAME_PORT 7075          // frames straight from the sender, see udp_frames.h; 0 to only use MQTT
+#define UDP_FRAME_TIMEOUT_MS 100     // an incomplete frame is dropped this long after its first fragment
+#define TCP_FRAME_PORT 7076          // a frame stream from the sender, see tcp_frames.h; 0 to not listen
+#define USB_FRAMES 1                 // the same stream over the USB serial port, see usb_frames.h
+
 #define WIFI_COUNTRY CYW43_COUNTRY_GERMANY
 #define WIFI_TIMEOUT_MS 10000
 
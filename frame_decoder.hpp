@@ -0,0 +1,536 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "pico/types.h"
+
+// Converts an image that arrives in chunks of any size (the parts of an MQTT message) row by
+// row straight into the panel's back buffer, so there's no need to collect the whole frame
+// first. Rows are converted from where they are received; only a row that is split across
+// chunks gets assembled in `carry`. Rows that are the same as in the previous frame are
+// skipped (see Hub75::row_unchanged()). `Panel` is Hub75 or a Hub75Panel.
+//
+// begin_rect() takes a rectangle of the canvas instead, given by an 8 byte header in front of
+// the pixels: x, y, width, height, as big endian 16 bit values.
+//
+// QOI (https://qoiformat.org) images are decoded op by op as the bytes come in. The decoded
+// pixels are collected in `carry` as RGB888 rows, which then go the same way as RGB888 input.
+// tools/qoi_frames.cpp encodes frames for it.
+//
+// begin_stream() takes numbered frames, with a 4 byte header: 'K' (keyframe) or 'D' (delta),
+// 16 or 32 (bits per pixel, as RGB565 or RGB888), and the sequence number as big endian 16
+// bits. A keyframe is a whole image. A delta holds runs of changed pixels against the frame
+// before it: pixels to skip and pixels that follow, both big endian 16 bits, then the pixels.
+// Runs go on across rows. A delta that doesn't follow the frame on the panel (a frame got lost,
+// or something else was shown in between) is dropped, and keyframe_needed() says so.
+// tools/delta_frames.cpp encodes frames for it.
+template <class Panel>
+class FrameDecoder {
+	public:
+	enum class Format {
+		RGB565,		// 2 bytes per pixel
+		RGB888,		// 4 bytes per pixel, 0x00RRGGBB
+		NATIVE,		// 4 bytes per pixel, the Pixel buffer as is, copied without conversion (see Hub75::updateFromNative())
+		QOI,		// a QOI image of the panel's size, alpha is ignored
+		INDEXED8,	// palette indices (see Hub75::set_palette()), 1 byte per pixel
+		INDEXED4,	// 2 pixels per byte, the left one in the high nibble; rows start on a byte
+		YCBCR420	// planar Y, Cb, Cr, the chroma planes at half width and height (see Hub75::updateRowFromYCbCr())
+	};
+
+	FrameDecoder(Panel &panel) : panel(panel), carry(new uint8_t[panel.width * 4]) {};
+	~FrameDecoder() { delete[] carry; delete[] indices; delete[] planar; };
+
+	bool idle() { return state == State::IDLE; };
+
+	void begin(Format format, bool bigEndian) {
+		start(format, bigEndian);
+		set_rect(0, 0, panel.width, panel.height);
+		if (format == Format::QOI) {
+			begin_qoi();
+		}
+		if (format == Format::INDEXED8 || format == Format::INDEXED4) {
+			// kept for repaint()
+			if (!indices) {
+				indices = new uint8_t[panel.width * panel.height];
+			}
+			keep_indices = true;
+			indices_valid = false;
+		}
+		if (format == Format::YCBCR420 && !planar) {
+			// the chroma comes after all of the luma
+			planar = new uint8_t[panel.width * panel.height + 2 * chroma_size()];
+		}
+		if (format == Format::NATIVE) {
+			panel.begin_update(false);
+		} else {
+			panel.begin_row_update(false);
+		}
+	}
+
+	// The rest of the canvas is kept. NATIVE isn't supported here.
+	void begin_rect(Format format, bool bigEndian) {
+		start(format, bigEndian);
+		header_len = 8;
+		if (format == Format::NATIVE || format == Format::QOI) {
+			fail();
+			return;
+		}
+		panel.begin_row_update(true);
+	}
+
+	void begin_stream() {
+		start(Format::RGB565, true);
+		stream = true;
+		header_len = 4;
+	}
+
+	// Checked (and cleared) after a delta frame
+	bool keyframe_needed() {
+		bool needed = need_keyframe;
+		need_keyframe = false;
+		return needed;
+	}
+
+	// After set_palette(): draws the last indexed frame again with the new colours, if it is
+	// still the one on the panel. That's all a colour cycling effect needs.
+	bool repaint() {
+		if (state != State::IDLE || !indices_valid || indexed_presents != panel.present_count) {
+			return false;
+		}
+		panel.begin_row_update(false);
+		uint bytes = indexed_row_bytes(panel.width, indices_bits);
+		for (uint y = 0; y < panel.height; y++) {
+			panel.row_changed(y);
+			panel.updateSpanFromIndexed(0, y, panel.width, indices + y * bytes, indices_bits);
+		}
+		panel.present();
+		indexed_presents = panel.present_count;
+		return true;
+	}
+
+	// Returns false if the frame can't be decoded (more data than rows), the rest of it is ignored then
+	bool push(const uint8_t *data, uint len) {
+		if (state != State::RECEIVING) {
+			return false;
+		}
+		if (format == Format::NATIVE) {
+			if (!panel.updateFromNative(received, data, len)) {
+				return fail();
+			}
+			received += len;
+			return true;
+		}
+		if (format == Format::QOI) {
+			return push_qoi(data, len);
+		}
+		if (format == Format::YCBCR420) {
+			return push_ycbcr(data, len);
+		}
+		if (stream && !delta && row == 0 && header_len) {
+			if (!take_header(data, len, 4)) {
+				return true;
+			}
+			if (!begin_stream_frame()) {
+				return fail();
+			}
+		}
+		if (delta) {
+			return push_delta(data, len);
+		}
+		if (header_len) {
+			if (!take_header(data, len, 8)) {
+				return true;
+			}
+			uint x = header[0] << 8 | header[1];
+			uint y = header[2] << 8 | header[3];
+			uint w = header[4] << 8 | header[5];
+			uint h = header[6] << 8 | header[7];
+			if (w == 0 || h == 0 || x >= panel.width || y >= panel.height || w > panel.width - x || h > panel.height - y) {
+				return fail();
+			}
+			set_rect(x, y, w, h);
+		}
+		if (carry_len) {
+			uint n = std::min(len, row_bytes - carry_len);
+			memcpy (carry + carry_len, data, n);
+			carry_len += n;
+			data += n;
+			len -= n;
+			if (carry_len < row_bytes) {
+				return true;
+			}
+			carry_len = 0;
+			if (!convert_row(carry)) {
+				return fail();
+			}
+		}
+		while (len >= row_bytes) {
+			if (!convert_row(data)) {
+				return fail();
+			}
+			data += row_bytes;
+			len -= row_bytes;
+		}
+		if (len) {
+			if (row == rect_h) {
+				return fail();
+			}
+			memcpy (carry, data, len);
+			carry_len = len;
+		}
+		return true;
+	}
+
+	// At the end of the message: presents the frame if it was complete, returns false otherwise
+	bool finish() {
+		bool complete = state == State::RECEIVING && (format == Format::NATIVE ?
+			received == panel.width * panel.height * 4 :
+			header_len == 0 && carry_len == 0 && (delta ? run_left == 0 : row == rect_h));
+		if (complete) {
+			panel.present();
+			indices_valid = keep_indices;
+			if (keep_indices) {
+				indices_bits = format == Format::INDEXED8 ? 8 : 4;
+				indexed_presents = panel.present_count;
+			}
+			if (stream) {
+				base_seq = seq;
+				base_presents = panel.present_count;
+				base_valid = true;
+			}
+		} else if (state != State::IDLE) {
+			panel.discard_update();
+			base_valid = false;		// the canvas may have been partly drawn
+			indices_valid = false;
+		}
+		state = State::IDLE;
+		return complete;
+	}
+
+	// The rest of the message won't come
+	void abort() {
+		if (state != State::IDLE) {
+			panel.discard_update();
+			base_valid = false;
+			indices_valid = false;
+		}
+		state = State::IDLE;
+	}
+
+	private:
+	enum class State {
+		IDLE,
+		RECEIVING,
+		FAILED		// waiting for the end of the message
+	};
+
+	void start(Format format, bool bigEndian) {
+		this->format = format;
+		this->bigEndian = bigEndian;
+		row = 0;
+		received = 0;
+		carry_len = 0;
+		header_len = 0;
+		rect_h = 0;
+		stream = false;
+		delta = false;
+		keep_indices = false;
+		state = State::RECEIVING;
+	}
+
+	// After the stream header
+	bool begin_stream_frame() {
+		seq = header[2] << 8 | header[3];
+		if (header[1] != 16 && header[1] != 32) {
+			return false;
+		}
+		format = header[1] == 16 ? Format::RGB565 : Format::RGB888;
+		set_rect(0, 0, panel.width, panel.height);
+		if (header[0] == 'K') {
+			panel.begin_row_update(false);
+			return true;
+		}
+		if (header[0] != 'D') {
+			return false;
+		}
+		if (!base_valid || seq != ((base_seq + 1) & 0xffff) || panel.present_count != base_presents) {
+			need_keyframe = true;
+			return false;
+		}
+		delta = true;
+		pos = 0;
+		run_left = 0;
+		panel.begin_row_update(true);
+		return true;
+	}
+
+	bool push_delta(const uint8_t *data, uint len) {
+		uint bpp = format == Format::RGB565 ? 2 : 4;
+		uint size = panel.width * panel.height;
+		while (len) {
+			if (run_left == 0) {
+				if (header_len == 0) {
+					header_len = 4;
+				}
+				if (!take_header(data, len, 4)) {
+					return true;
+				}
+				pos += header[0] << 8 | header[1];
+				run_left = header[2] << 8 | header[3];
+				if (pos > size || run_left > size - pos) {
+					return fail();
+				}
+				continue;
+			}
+			if (carry_len) {
+				// a pixel split across chunks
+				uint n = std::min(len, bpp - carry_len);
+				memcpy (carry + carry_len, data, n);
+				carry_len += n;
+				data += n;
+				len -= n;
+				if (carry_len < bpp) {
+					return true;
+				}
+				carry_len = 0;
+				write_span(carry, 1);
+				continue;
+			}
+			uint n = std::min({len / bpp, run_left, panel.width - pos % panel.width});
+			if (n == 0) {
+				memcpy (carry, data, len);
+				carry_len = len;
+				return true;
+			}
+			write_span(data, n);
+			data += n * bpp;
+			len -= n * bpp;
+		}
+		return true;
+	}
+
+	inline void write_span(const uint8_t *src, uint n) {
+		uint y = pos / panel.width;
+		uint x = pos % panel.width;
+		panel.row_changed(y);
+		draw(x, y, n, src);
+		pos += n;
+		run_left -= n;
+	}
+
+	// Collects the header of `size` bytes, returns true once it's complete
+	bool take_header(const uint8_t *&data, uint &len, uint size) {
+		uint n = std::min(len, header_len);
+		memcpy (header + size - header_len, data, n);
+		header_len -= n;
+		data += n;
+		len -= n;
+		return header_len == 0;
+	}
+
+	uint chroma_size() {
+		return (panel.width + 1) / 2 * ((panel.height + 1) / 2);
+	}
+
+	// Collects the planes, converting each pair of rows once its row of Cr is there
+	bool push_ycbcr(const uint8_t *data, uint len) {
+		uint w = panel.width;
+		uint cw = (w + 1) / 2;
+		uint luma_size = w * panel.height;
+		uint size = luma_size + 2 * chroma_size();
+		if (len > size - received) {
+			return fail();
+		}
+		memcpy (planar + received, data, len);
+		received += len;
+		if (received <= luma_size + chroma_size()) {
+			return true;
+		}
+		uint chroma_rows = (received - luma_size - chroma_size()) / cw;
+		while (row < panel.height && row / 2 < chroma_rows) {
+			const uint8_t *luma = planar + row * w;
+			const uint8_t *cb = planar + luma_size + row / 2 * cw;
+			const uint8_t *cr = cb + chroma_size();
+			uint32_t hash = panel.hash_row(luma, w, panel.hash_row(cb, cw, panel.hash_row(cr, cw, (uint)format << 1)));
+			if (!panel.row_unchanged(row, hash)) {
+				panel.updateRowFromYCbCr(row, luma, cb, cr);
+			}
+			row++;
+		}
+		return true;
+	}
+
+	void begin_qoi() {
+		header_len = 14;
+		memset (qoi_index, 0, sizeof(qoi_index));
+		qoi_px[0] = qoi_px[1] = qoi_px[2] = 0;
+		qoi_px[3] = 255;
+		op_len = 0;
+		tail = 0;
+	}
+
+	static inline uint qoi_op_size(uint8_t op) {
+		return op == 0xfe ? 4 : op == 0xff ? 5 : (op & 0xc0) == 0x80 ? 2 : 1;
+	}
+
+	bool push_qoi(const uint8_t *data, uint len) {
+		if (header_len) {
+			if (!take_header(data, len, 14)) {
+				return true;
+			}
+			uint w = header[4] << 24 | header[5] << 16 | header[6] << 8 | header[7];
+			uint h = header[8] << 24 | header[9] << 16 | header[10] << 8 | header[11];
+			if (memcmp(header, "qoif", 4) != 0 || w != panel.width || h != panel.height) {
+				return fail();
+			}
+		}
+		while (len) {
+			if (row == rect_h) {
+				// only the end marker (7 zeroes and a 1) may follow the pixels
+				tail += len;
+				return tail <= 8 || fail();
+			}
+			if (op_len == 0) {
+				op_size = qoi_op_size(*data);
+			}
+			uint n = std::min(len, op_size - op_len);
+			memcpy (op + op_len, data, n);
+			op_len += n;
+			data += n;
+			len -= n;
+			if (op_len < op_size) {
+				return true;
+			}
+			op_len = 0;
+			uint8_t *px = qoi_px;
+			uint run = 1;
+			if (op[0] == 0xfe || op[0] == 0xff) {
+				memcpy (px, op + 1, op[0] == 0xff ? 4 : 3);
+			} else switch (op[0] >> 6) {
+				case 0:		// index
+					memcpy (px, qoi_index[op[0]], 4);
+					break;
+				case 1:		// diff
+					px[0] += ((op[0] >> 4) & 3) - 2;
+					px[1] += ((op[0] >> 2) & 3) - 2;
+					px[2] += (op[0] & 3) - 2;
+					break;
+				case 2: {	// luma
+					int dg = (op[0] & 0x3f) - 32;
+					px[0] += dg - 8 + (op[1] >> 4);
+					px[1] += dg;
+					px[2] += dg - 8 + (op[1] & 0x0f);
+					break;
+				}
+				case 3:		// run
+					run = (op[0] & 0x3f) + 1;
+					break;
+			}
+			memcpy (qoi_index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63], px, 4);
+			for (; run; run--) {
+				uint8_t *d = carry + carry_len;
+				d[0] = 0;
+				d[1] = px[0];
+				d[2] = px[1];
+				d[3] = px[2];
+				carry_len += 4;
+				if (carry_len == row_bytes) {
+					carry_len = 0;
+					if (!convert_row(carry)) {
+						return fail();
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	void set_rect(uint x, uint y, uint w, uint h) {
+		rect_x = x;
+		rect_y = y;
+		rect_w = w;
+		rect_h = h;
+		if (format == Format::INDEXED8 || format == Format::INDEXED4) {
+			row_bytes = indexed_row_bytes(w, format == Format::INDEXED8 ? 8 : 4);
+		} else {
+			row_bytes = w * (format == Format::RGB565 ? 2 : 4);	// QOI: decoded RGB888
+		}
+	}
+
+	static uint indexed_row_bytes(uint w, uint bits) {
+		return bits == 8 ? w : (w + 1) / 2;
+	}
+
+	inline bool convert_row(const uint8_t *src) {
+		if (row == rect_h) {
+			return false;
+		}
+		uint y = rect_y + row++;
+		if (rect_w < panel.width) {
+			panel.row_changed(y);
+			draw(rect_x, y, rect_w, src);
+			return true;
+		}
+		if (keep_indices) {
+			memcpy (indices + y * row_bytes, src, row_bytes);
+		}
+		// a row that's the same as the one converted last time can stay, e.g. most of a clock
+		if (panel.row_unchanged(y, panel.hash_row(src, row_bytes, (uint)format << 1 | bigEndian))) {
+			return true;
+		}
+		draw(0, y, panel.width, src);
+		return true;
+	}
+
+	inline void draw(uint x, uint y, uint n, const uint8_t *src) {
+		switch (format) {
+			case Format::RGB565: panel.updateSpanFromRGB565(x, y, n, src, bigEndian); break;
+			case Format::INDEXED8: panel.updateSpanFromIndexed(x, y, n, src, 8); break;
+			case Format::INDEXED4: panel.updateSpanFromIndexed(x, y, n, src, 4); break;
+			default: panel.updateSpanFromRGB888(x, y, n, src, format == Format::QOI || bigEndian); break;
+		}
+	}
+
+	bool fail() {
+		state = State::FAILED;
+		return false;
+	}
+
+	Panel &panel;
+	uint8_t *carry;
+	uint carry_len = 0;
+	uint row_bytes = 0;
+	uint row = 0;			// within the rectangle
+	uint rect_x = 0, rect_y = 0, rect_w = 0, rect_h = 0;
+	uint8_t header[14];
+	uint header_len = 0;	// header bytes still to come
+	uint received = 0;		// NATIVE: bytes copied so far
+	// QOI decoder state
+	uint8_t qoi_index[64][4];
+	uint8_t qoi_px[4];		// RGBA of the previous pixel
+	uint8_t op[5];			// op being received
+	uint op_len = 0;
+	uint op_size = 0;
+	uint tail = 0;			// bytes after the last pixel
+	// Numbered frames
+	bool stream = false;
+	bool delta = false;
+	uint seq = 0;
+	uint pos = 0;			// delta: pixel index (y * width + x)
+	uint run_left = 0;		// delta: pixels still to come in the current run
+	bool base_valid = false;	// the panel shows frame base_seq
+	uint base_seq = 0;
+	uint32_t base_presents = 0;	// present_count after it, as any other present() replaces it
+	bool need_keyframe = false;
+	// Indexed frames
+	uint8_t *indices = nullptr;	// the last one, for repaint()
+	bool keep_indices = false;
+	bool indices_valid = false;
+	uint indices_bits = 8;
+	uint32_t indexed_presents = 0;	// present_count after it
+	uint8_t *planar = nullptr;	// YCbCr planes as received
+	Format format = Format::RGB565;
+	bool bigEndian = true;
+	State state = State::IDLE;
+};
@@ -0,0 +1,97 @@
+//
+//  frame_fragments.c
+//
+//  Runs in the producer context of its source, the payload goes to the ingest ring in the
+//  pieces it comes in.
+//
+
+#include "frame_fragments.h"
+
+#include <string.h>
+
+void frame_fragments_init (frame_fragments_t *s, ingest_source_t source) {
+	memset (s, 0, sizeof(*s));
+	s->source = source;
+}
+
+void frame_fragments_timeout (frame_fragments_t *s) {
+	if (s->receiving) {
+		ingest_abort (s->source);
+		s->receiving = false;
+		s->stats.frames_dropped++;
+	}
+}
+
+static uint16_t get_be16 (const uint8_t *p) {
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Done with the datagram
+static void end_fragment (frame_fragments_t *s) {
+	s->next_index++;
+	if (s->last) {
+		s->receiving = false;
+		s->stats.frames++;
+	}
+}
+
+int frame_fragments_begin (frame_fragments_t *s, const uint8_t *start, uint16_t len, uint16_t size) {
+	s->stats.packets++;
+	s->started = false;
+	if (len < FRAME_FRAGMENT_HEADER) {
+		s->stats.fragments_dropped++;
+		return -1;
+	}
+	uint16_t id = get_be16 (&start[0]);
+	uint16_t index = get_be16 (&start[2]);
+	uint16_t count = get_be16 (&start[4]);
+	uint8_t topic_len = start[6];
+	uint16_t offset = FRAME_FRAGMENT_HEADER + topic_len;
+	if (index >= count || offset > size) {
+		s->stats.fragments_dropped++;
+		return -1;
+	}
+
+	if (index == 0) {
+		if (topic_len == 0 || topic_len > INGEST_TOPIC_MAX || offset > len) {
+			s->stats.fragments_dropped++;
+			return -1;
+		}
+		frame_fragments_timeout (s);	// superseded
+		char topic[INGEST_TOPIC_MAX + 1];
+		memcpy (topic, &start[FRAME_FRAGMENT_HEADER], topic_len);
+		topic[topic_len] = 0;
+		ingest_begin (s->source, topic);
+		s->receiving = true;
+		s->started = count > 1;
+		s->frame_id = id;
+		s->next_index = 0;
+		s->fragment_count = count;
+	} else if (!s->receiving || id != s->frame_id || count != s->fragment_count || index != s->next_index) {
+		if (s->receiving && id == s->frame_id) {
+			// a fragment got lost or overtaken, the rest of this frame is of no use
+			frame_fragments_timeout (s);
+		}
+		s->stats.fragments_dropped++;
+		return -1;
+	}
+
+	s->last = index == count - 1;
+	s->payload_left = size - offset;
+	if (s->payload_left == 0) {
+		ingest_push (s->source, NULL, 0, s->last);
+		end_fragment (s);
+	}
+	return offset;
+}
+
+void frame_fragments_payload (frame_fragments_t *s, const uint8_t *data, uint16_t len) {
+	if (len == 0 || len > s->payload_left) {
+		return;
+	}
+	s->payload_left -= len;
+	ingest_push (s->source, data, len, s->last && s->payload_left == 0);
+	if (s->payload_left == 0) {
+		end_fragment (s);
+	}
+}
@@ -0,0 +1,62 @@
+//
+//  frame_fragments.h
+//
+//  Messages split into datagrams (UDP), each one starting with a big endian header:
+//
+//    frame id (u16), fragment index (u16), fragment count (u16), topic length (u8), topic
+//
+//  with the topics and payloads as over MQTT (e.g. "i16" and a frame), the topic (at most
+//  INGEST_TOPIC_MAX) only in fragment 0. Only one frame is in flight: its fragments have to come in order, which they do
+//  on a local network, anything else drops it. The payload goes to the ingest ring as it comes.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ingest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_FRAGMENT_HEADER 7
+
+typedef struct {
+	uint32_t packets;
+	uint32_t frames;			// completely received
+	uint32_t frames_dropped;	// incomplete: lost or reordered fragments, or timed out
+	uint32_t fragments_dropped;	// not belonging to the frame being received, or malformed
+} frame_fragments_stats_t;
+
+typedef struct {
+	ingest_source_t source;
+	bool receiving;
+	bool started;				// the last datagram started a frame of more than one fragment
+	bool last;					// the datagram is the frame's last fragment
+	uint16_t frame_id;
+	uint16_t next_index;
+	uint16_t fragment_count;
+	uint16_t payload_left;		// of the datagram
+	frame_fragments_stats_t stats;
+} frame_fragments_t;
+
+void frame_fragments_init (frame_fragments_t *s, ingest_source_t source);
+
+// A datagram of `size` bytes came in, the first `len` of them at `start`: at least the header
+// and the topic, as far as the datagram has them. Returns the offset of its payload, which is
+// then passed to frame_fragments_payload(), or -1 if the datagram is dropped.
+// A frame of more than one fragment is dropped by frame_fragments_timeout() if it isn't complete
+// in time: `started` tells when it began, and it ends when `receiving` goes off.
+int frame_fragments_begin (frame_fragments_t *s, const uint8_t *start, uint16_t len, uint16_t size);
+
+// All of the payload of the datagram, in the pieces it is in
+void frame_fragments_payload (frame_fragments_t *s, const uint8_t *data, uint16_t len);
+
+// Drops the frame being received
+void frame_fragments_timeout (frame_fragments_t *s);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
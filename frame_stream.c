@@ -0,0 +1,119 @@
+//
+//  frame_stream.c
+//
+//  Runs in the producer context of its source, the payload goes to the ingest ring in the
+//  pieces it comes in.
+//
+
+#include "frame_stream.h"
+
+#include <string.h>
+
+enum {
+	SYNC_F,
+	SYNC_R,
+	TOPIC_LEN,
+	TOPIC,
+	LENGTH,
+	PAYLOAD,
+};
+
+void frame_stream_init (frame_stream_t *s, ingest_source_t source) {
+	memset (s, 0, sizeof(*s));
+	s->source = source;
+}
+
+void frame_stream_reset (frame_stream_t *s) {
+	if (s->state == PAYLOAD) {
+		ingest_abort (s->source);
+	}
+	s->state = SYNC_F;
+}
+
+// Done with the header, passes an empty message on straight away
+static void start_payload (frame_stream_t *s) {
+	s->topic[s->topic_len] = 0;
+	ingest_begin (s->source, s->topic);
+	if (s->remaining == 0) {
+		ingest_push (s->source, NULL, 0, true);
+		s->stats.messages++;
+		s->state = SYNC_F;
+	} else {
+		s->state = PAYLOAD;
+	}
+}
+
+uint32_t frame_stream_feed (frame_stream_t *s, const uint8_t *data, uint32_t len) {
+	uint32_t queued = 0;
+	while (len > 0) {
+		if (s->state == PAYLOAD) {
+			uint32_t n = len < s->remaining ? len : s->remaining;
+			if (n > 0xffff) {
+				n = 0xffff;
+			}
+			s->remaining -= n;
+			if (ingest_push (s->source, data, (uint16_t)n, s->remaining == 0)) {
+				queued += n;
+				s->stats.bytes += n;
+			} else {
+				s->stats.dropped_bytes += n;
+			}
+			if (s->remaining == 0) {
+				s->stats.messages++;
+				s->state = SYNC_F;
+			}
+			data += n;
+			len -= n;
+			continue;
+		}
+		uint8_t c = *data++;
+		len--;
+		switch (s->state) {
+			case SYNC_F:
+				if (c == 'F') {
+					s->state = SYNC_R;
+				} else {
+					s->stats.skipped_bytes++;
+				}
+				break;
+			case SYNC_R:
+				if (c == 'R') {
+					s->state = TOPIC_LEN;
+				} else {
+					s->stats.skipped_bytes++;
+					s->state = c == 'F' ? SYNC_R : SYNC_F;
+				}
+				break;
+			case TOPIC_LEN:
+				if (c == 0 || c > INGEST_TOPIC_MAX) {
+					s->stats.skipped_bytes += 3;
+					s->state = SYNC_F;
+				} else {
+					s->topic_len = c;
+					s->got = 0;
+					s->state = TOPIC;
+				}
+				break;
+			case TOPIC:
+				s->topic[s->got++] = (char)c;
+				if (s->got == s->topic_len) {
+					s->got = 0;
+					s->remaining = 0;
+					s->state = LENGTH;
+				}
+				break;
+			case LENGTH:
+				s->remaining = s->remaining << 8 | c;
+				if (++s->got == 4) {
+					if (s->remaining > FRAME_STREAM_PAYLOAD_MAX) {
+						s->stats.skipped_bytes += 7 + s->topic_len;
+						s->state = SYNC_F;
+					} else {
+						start_payload (s);
+					}
+				}
+				break;
+		}
+	}
+	return queued;
+}
@@ -0,0 +1,54 @@
+//
+//  frame_stream.h
+//
+//  Messages over a byte stream (TCP, USB), each one:
+//
+//    'F' 'R', topic length (u8), topic, payload length (u32, big endian), payload
+//
+//  with the topics and payloads as over MQTT (e.g. "i16" and a frame), a topic of at most
+//  INGEST_TOPIC_MAX. Bytes that don't start a message are skipped until the next 'F' 'R', so
+//  that a stream can resynchronise.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ingest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_STREAM_PAYLOAD_MAX (1024 * 1024)	// anything longer is taken for garbage
+
+typedef struct {
+	uint32_t messages;			// completely passed on
+	uint32_t bytes;				// payload
+	uint32_t dropped_bytes;		// payload that didn't fit into the ingest ring
+	uint32_t skipped_bytes;		// outside of a message
+} frame_stream_stats_t;
+
+typedef struct {
+	ingest_source_t source;
+	uint8_t state;
+	uint8_t topic_len;
+	uint8_t got;				// of the current header field
+	char topic[INGEST_TOPIC_MAX + 1];
+	uint32_t remaining;			// payload bytes still to come
+	frame_stream_stats_t stats;
+} frame_stream_t;
+
+void frame_stream_init (frame_stream_t *s, ingest_source_t source);
+
+// Passes the payload on to the ingest ring; returns how many bytes got queued there, the rest
+// (headers, dropped data) is done with on return
+uint32_t frame_stream_feed (frame_stream_t *s, const uint8_t *data, uint32_t len);
+
+// The stream broke off, drops a message in progress
+void frame_stream_reset (frame_stream_t *s);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -1,9 +1,11 @@
 #include <cstring>
 #include <algorithm>
 #include <cmath>
+#include <cassert>
 #include "stdarg.h"
 #include "stdio.h"
 
+#include "hardware/sync.h"
 #include "hub75.hpp"
 
 #include "font_5x7.h"
@@ -11,8 +13,8 @@
 static inline Pixel makePixel (uint32_t px);
 static inline Pixel makePixel (uint8_t r, uint8_t g, uint8_t b);
 
-Hub75::Hub75(uint width, uint height, Pixel *buffer, PanelType panel_type, bool inverted_stb, COLOR_ORDER color_order)
- : width(width), height(height), panel_type(panel_type), inverted_stb(inverted_stb), color_order(color_order)
+Hub75::Hub75(uint width, uint height, Pixel *buffer, uint8_t *planes, ScanList *lists, PanelType panel_type, bool inverted_stb, COLOR_ORDER color_order, SCAN_MODE scan_mode, uint bit_depth, uint chains, uint chain2_data, uint chain2_clk)
+ : width(width), height(height), rows(height / 2), chains(chains), bit_depth(bit_depth), max_bit_depth(bit_depth), scan_mode(scan_mode), panel_type(panel_type), inverted_stb(inverted_stb), color_order(color_order), pin_chain2_data(chain2_data), pin_chain2_clk(chain2_clk)
  {
 	// Set up allllll the GPIO
 	gpio_init(pin_r0); gpio_set_function(pin_r0, GPIO_FUNC_SIO); gpio_set_dir(pin_r0, true); gpio_put(pin_r0, 0);
@@ -33,13 +35,51 @@ Hub75::Hub75(uint width, uint height, Pixel *buffer, PanelType panel_type, bool
 	gpio_init(pin_stb); gpio_set_function(pin_stb, GPIO_FUNC_SIO); gpio_set_dir(pin_stb, true); gpio_put(pin_clk, !stb_polarity);
 	gpio_init(pin_oe); gpio_set_function(pin_oe, GPIO_FUNC_SIO); gpio_set_dir(pin_oe, true); gpio_put(pin_clk, !oe_polarity);
 
+	uint frames = scan_mode == SCAN_MODE::BIT_PLANES ? 1 : 2;
 	if (buffer == nullptr) {
-		back_buffer = new Pixel[width * height];
+		buffer = new Pixel[width * height * frames];
 		managed_buffer = true;
 	} else {
-		back_buffer = buffer;
 		managed_buffer = false;
 	}
+	front_buffer = buffer;
+	back_buffer = buffer + width * height * (frames - 1);
+
+	assert(chains == 1 || (chains == 2 && scan_mode == SCAN_MODE::BIT_PLANES));
+	if (chains == 2) {
+		// clear of the pins of the first chain (0 to 13) and of each other
+		assert(pin_chain2_data > pin_oe && pin_chain2_data + 6 <= NUM_BANK0_GPIOS);
+		assert(pin_chain2_clk > pin_oe && pin_chain2_clk < NUM_BANK0_GPIOS);
+		assert(pin_chain2_clk < pin_chain2_data || pin_chain2_clk >= pin_chain2_data + 6);
+		sm_row = 2;
+	}
+
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		// 4 columns per 32 bit DMA word
+		assert(width % (4 * chains) == 0);
+		uint plane_size = max_bit_depth * rows * width;
+		if (planes == nullptr) {
+			planes = new uint8_t[plane_size * 2];
+			managed_planes = true;
+		}
+		front_planes = planes;
+		back_planes = planes + plane_size;
+		memset (front_planes, 0, plane_size * 2);
+	}
+
+	if (lists == nullptr) {
+		uint entries = scan_entries(max_bit_depth, rows);
+		lists = new ScanList[2];
+		for (uint i = 0; i < 2; i++) {
+			lists[i] = {new const void *[entries + 1], new uint32_t[entries], new uint8_t[entries], new uint8_t[entries], 0, 0};
+		}
+		managed_lists = true;
+	}
+	front_list = &lists[0];
+	back_list = &lists[1];
+
+	update_gamma();
+	update_schedule();
 
 	if (brightness == 0) {
 		if (width >= 64) brightness = 6;
@@ -48,12 +88,36 @@ Hub75::Hub75(uint width, uint height, Pixel *buffer, PanelType panel_type, bool
 		if (width >= 160) brightness = 1;
 	}
 	
+	memset (front_buffer, 0, width * height * sizeof(*front_buffer));
 	clear();
+
+	// Both frames are blank
+	memset (row_planes, 0, sizeof(row_planes));
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		build_scan_list(front_list, front_planes);
+		build_scan_list(back_list, back_planes);
+	} else {
+		build_scan_list(front_list, front_buffer);
+		build_scan_list(back_list, back_buffer);
+	}
 }
 
 Hub75::~Hub75() {
 	if (managed_buffer) {
-		delete[] back_buffer;
+		delete[] std::min(front_buffer, back_buffer);
+	}
+	if (managed_planes) {
+		delete[] std::min(front_planes, back_planes);
+	}
+	if (managed_lists) {
+		ScanList *lists = std::min(front_list, back_list);
+		for (uint i = 0; i < 2; i++) {
+			delete[] lists[i].data;
+			delete[] lists[i].row_words;
+			delete[] lists[i].planes;
+			delete[] lists[i].shifts;
+		}
+		delete[] lists;
 	}
 }
 
@@ -89,6 +153,20 @@ void Hub75::FM6126A_setup() {
 	FM6126A_write_register(0b0000001000000000, 13);
 }
 
+const pio_program_t *Hub75::data_program() {
+	return scan_mode == SCAN_MODE::BIT_PLANES ? &hub75_data_planes_program : &hub75_data_rgb888_program;
+}
+
+const pio_program_t *Hub75::row_program() {
+	if (scan_mode == SCAN_MODE::BIT_PLANES && chains == 2) {
+		return inverted_stb ? &hub75_row_chained_dual_inverted_program : &hub75_row_chained_dual_program;
+	}
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		return inverted_stb ? &hub75_row_chained_inverted_program : &hub75_row_chained_program;
+	}
+	return inverted_stb ? &hub75_row_inverted_program : &hub75_row_program;
+}
+
 void Hub75::start(irq_handler_t handler) {
 	if(handler) {
 		if (panel_type == PANEL_FM6126A) {
@@ -98,18 +176,33 @@ void Hub75::start(irq_handler_t handler) {
 		// Claim the PIO so we can clean it upon soft restart
 		pio_sm_claim(pio, sm_data);
 		pio_sm_claim(pio, sm_row);
+		if (chains == 2) {
+			pio_sm_claim(pio, sm_data2);
+		}
 
-		data_prog_offs = pio_add_program(pio, &hub75_data_rgb888_program);
-		if (inverted_stb) {
-			row_prog_offs = pio_add_program(pio, &hub75_row_inverted_program);
+		data_prog_offs = pio_add_program(pio, data_program());
+		row_prog_offs = pio_add_program(pio, row_program());
+		if (scan_mode == SCAN_MODE::BIT_PLANES) {
+			// Clear handshake flags that a soft restart may have left set
+			pio->irq = 0xf;
+			pio->fdebug = 1u << (PIO_FDEBUG_TXOVER_LSB + sm_data2);
+			hub75_data_planes_program_init(pio, sm_data, data_prog_offs, DATA_BASE_PIN, pin_clk, width / chains);
+			if (chains == 2) {
+				hub75_data_planes_program_init(pio, sm_data2, data_prog_offs, pin_chain2_data, pin_chain2_clk, width / chains);
+				hub75_row_chained_dual_program_init(pio, sm_row, row_prog_offs, ROWSEL_BASE_PIN, ROWSEL_N_PINS, pin_stb);
+			} else {
+				hub75_row_chained_program_init(pio, sm_row, row_prog_offs, ROWSEL_BASE_PIN, ROWSEL_N_PINS, pin_stb);
+			}
 		} else {
-			row_prog_offs = pio_add_program(pio, &hub75_row_program);
+			hub75_data_rgb888_program_init(pio, sm_data, data_prog_offs, DATA_BASE_PIN, pin_clk);
+			hub75_row_program_init(pio, sm_row, row_prog_offs, ROWSEL_BASE_PIN, ROWSEL_N_PINS, pin_stb);
 		}
-		hub75_data_rgb888_program_init(pio, sm_data, data_prog_offs, DATA_BASE_PIN, pin_clk);
-		hub75_row_program_init(pio, sm_row, row_prog_offs, ROWSEL_BASE_PIN, ROWSEL_N_PINS, pin_stb);
 
 		// Prevent flicker in Python caused by the smaller dataset just blasting through the PIO too quickly
 		pio_sm_set_clkdiv(pio, sm_data, width <= 32 ? 2.0f : 1.0f);
+		if (chains == 2) {
+			pio_sm_set_clkdiv(pio, sm_data2, width <= 32 ? 2.0f : 1.0f);
+		}
 
 		dma_channel = dma_claim_unused_channel(true);
 		dma_channel_config config = dma_channel_get_default_config(dma_channel);
@@ -118,23 +211,340 @@ void Hub75::start(irq_handler_t handler) {
 		channel_config_set_dreq(&config, pio_get_dreq(pio, sm_data, true));
 		dma_channel_configure(dma_channel, &config, &pio->txf[sm_data], NULL, 0, false);
 
+		if (scan_mode == SCAN_MODE::BIT_PLANES) {
+			setup_scan_chain(config);
+		}
+
 		// Same handler for both DMA channels
 		irq_add_shared_handler(DMA_IRQ_0, handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
-
+		// BIT_PLANES mode: only raised at the end of front_list, i.e. once per refresh
 		dma_channel_set_irq0_enabled(dma_channel, true);
 
+		// Free running cycle counter for the stats, see cycle_count()
+		systick_hw->rvr = 0xffffff;
+		systick_hw->cvr = 0;
+		systick_hw->csr = 0x5;	// enabled, processor clock, no interrupt
+		read_stats(true);
+
 		irq_set_enabled(pio_get_dreq(pio, sm_data, true), true);
 		irq_set_enabled(DMA_IRQ_0, true);
 
-		row = 0;
-		bit = 0;
+		if (scan_mode == SCAN_MODE::BIT_PLANES) {
+			start_scan_list();
+		} else {
+			entry = 0;
+			data_shift = front_list->skip + front_list->planes[0];
+			hub75_data_rgb888_set_shift(pio, data_prog_offs, data_shift);
+			dma_channel_set_trans_count(dma_channel, width * 2, false);
+			dma_channel_set_read_addr(dma_channel, front_list->data[0], true);
+		}
+	}
+}
+
+static void release_dma_channel(int channel) {
+	if (channel != -1 && dma_channel_is_claimed(channel)) {
+		dma_channel_abort(channel);
+		dma_channel_acknowledge_irq0(channel);
+		dma_channel_unclaim(channel);
+	}
+}
+
+// Stops the channel from triggering its control channel once finished or aborted
+static void unchain_dma_channel(int channel) {
+	if (channel != -1 && dma_channel_is_claimed(channel)) {
+		dma_channel_config config = dma_get_channel_config(channel);
+		channel_config_set_chain_to(&config, channel);
+		dma_channel_set_config(channel, &config, false);
+	}
+}
+
+// BIT_PLANES mode: the data channel sends one plane row (width / 4 words) into sm_data, then
+// chains to a control channel that loads the next record address of front_list->data into it.
+// The nullptr at the end of the list does not trigger it but raises the (quiet) data channel's
+// interrupt, where refresh_complete() restarts the list. The row records of a refresh are a single
+// transfer into sm_row, and the two PIO programs synchronise each other per row.
+// With two chains, the data channel alternates between the adjacent FIFOs of sm_data and
+// sm_data2 (a write ring of two words), paced by sm_data. Both SMs take a word every four
+// columns and are released by sm_row together, so sm_data2 should keep up. If it ever doesn't,
+// its word is dropped and the chains get out of step; refresh_complete() counts that as missed.
+// The second chain has to be on pio0 too: the handshake with sm_row uses PIO IRQ flags, which
+// aren't shared between the PIO blocks, and the write ring needs adjacent FIFOs. (On a Pico W,
+// pio1 isn't free anyway, the CYW43 driver runs its SPI on it.)
+void Hub75::setup_scan_chain(dma_channel_config data_config) {
+	dma_data_ctrl_channel = dma_claim_unused_channel(true);
+	dma_row_channel = dma_claim_unused_channel(true);
+
+	if (chains == 2) {
+		assert(sm_data2 == sm_data + 1);
+		channel_config_set_write_increment(&data_config, true);
+		channel_config_set_ring(&data_config, true, 3);
+	}
+
+	channel_config_set_chain_to(&data_config, dma_data_ctrl_channel);
+	channel_config_set_irq_quiet(&data_config, true);
+	dma_channel_configure(dma_channel, &data_config, &pio->txf[sm_data], nullptr, width / 4, false);
+
+	dma_channel_config config = dma_channel_get_default_config(dma_row_channel);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+	channel_config_set_dreq(&config, pio_get_dreq(pio, sm_row, true));
+	dma_channel_configure(dma_row_channel, &config, &pio->txf[sm_row], nullptr, 0, false);
+
+	config = dma_channel_get_default_config(dma_data_ctrl_channel);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+	dma_channel_configure(dma_data_ctrl_channel, &config, &dma_hw->ch[dma_channel].al3_read_addr_trig, nullptr, 1, false);
+}
+
+// Starts both DMA streams at the top of front_list
+void Hub75::start_scan_list() {
+	// sm_row's FIFO holds several rows, so its stream has long been sent by now
+	uint32_t t = cycle_count();
+	dma_channel_wait_for_finish_blocking(dma_row_channel);
+	stats.stall_row += cycles_between(t, cycle_count());
+	dma_channel_transfer_from_buffer_now(dma_row_channel, front_list->row_words, front_list->count);
+	dma_channel_set_read_addr(dma_data_ctrl_channel, front_list->data, true);
+	// sticky until sm_data next runs out of data, checked by refresh_complete()
+	pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm_data);
+}
+
+// Binary code modulation: plane p is shown for 2^p time units. Scanned plane by plane, the top
+// plane is a single on-time of half the refresh, so the flicker frequency is the refresh rate.
+// With bcm_slices = S, the planes from the top down to the one of weight 2^k (S = 2^(depth-1-k))
+// are cut into slices of 2^k, and the refresh into S segments that each get one slice of the
+// top plane, the other slices spread evenly, and their share of the low planes. Every segment
+// holds about the same on-time, so the light is emitted S times per refresh, at the cost of
+// 2S - 1 - (depth - k) extra passes (more row pulses, same data per pulse).
+void Hub75::update_schedule() {
+	uint segments = std::min(bcm_slices, 1u << (bit_depth - 1));
+	uint k = bit_depth - 1;
+	while ((1u << (bit_depth - 1 - k)) < segments) {
+		k--;
+	}
+	schedule_length = 0;
+	for (uint seg = 0; seg < segments; seg++) {
+		for (uint p = 0; p < bit_depth; p++) {
+			bool add;
+			if (p < k) {
+				// low planes go to the segments in turn, the larger ones first
+				add = (k - 1 - p) * segments / k == seg;
+			} else {
+				// 2^(p-k) slices, one in every (segments >> (p-k))th segment, placed in between
+				// those of the plane above
+				uint stride = segments >> (p - k);
+				add = seg % stride == stride / 2;
+			}
+			if (add) {
+				schedule[schedule_length++] = {(uint8_t)p, (uint8_t)std::min(p, k)};
+			}
+		}
+	}
+}
+
+// Lists the (plane, row) pairs to scan, pass by pass of the schedule, leaving out those without
+// any lit LED with skip_empty (see set_skip_empty()). `frame` is the Pixel buffer or set of planes
+// that row_planes was taken from.
+void Hub75::build_scan_list(ScanList *list, const void *frame) {
+	uint n = 0;
+	for (uint i = 0; i < schedule_length; i++) {
+		uint p = schedule[i].plane;
+		for (uint r = 0; r < rows; r++) {
+			if (skip_empty && !(row_planes[r] & (1 << p))) {
+				continue;
+			}
+			if (scan_mode == SCAN_MODE::BIT_PLANES) {
+				list->data[n] = (const uint8_t *)frame + (p * rows + r) * width;
+			} else {
+				list->data[n] = (const Pixel *)frame + r * width * 2;
+			}
+			list->row_words[n] = r;
+			list->planes[n] = p;
+			list->shifts[n] = schedule[i].shift;
+			n++;
+		}
+	}
+	if (n == 0) {
+		// nothing lit at all, but the scan needs something to run on
+		list->data[n] = frame;
+		list->row_words[n] = 0;
+		list->planes[n] = 0;
+		list->shifts[n] = 0;
+		n++;
+	}
+	list->data[n] = nullptr;
+	list->count = n;
+	list->skip = BIT_DEPTH - bit_depth;
+	update_row_words(list);
+}
+
+void Hub75::update_row_words(ScanList *list) {
+	for (uint i = 0; i < list->count; i++) {
+		list->row_words[i] = (list->row_words[i] & 0x1f) | (brightness << 5 << list->shifts[i]);
+	}
+}
+
+// Same curve as GAMMA_10BIT, rounded to bit_depth bits and placed in the top bits of the channel
+void Hub75::update_gamma() {
+	uint shift = BIT_DEPTH - bit_depth;
+	uint max = (1 << bit_depth) - 1;
+	for (uint i = 0; i < 256; i++) {
+		uint v = (GAMMA_10BIT[i] + ((1 << shift) >> 1)) >> shift;
+		gamma[i] = std::min(v, max) << shift;
+	}
+	update_luts();
+}
 
-		hub75_data_rgb888_set_shift(pio, data_prog_offs, bit);
-		dma_channel_set_trans_count(dma_channel, width * 2, false);
-		dma_channel_set_read_addr(dma_channel, &back_buffer, true);
+// The bulk converters look up each channel's share of the Pixel instead of going through
+// makePixel(). RGB565 channels get their own tables, indexed by the 5 or 6 bit value
+// (scaled up the same way as the per-pixel path does).
+void Hub75::update_luts() {
+	uint r_shift = 0, g_shift = 0, b_shift = 0;	// where makePixel() puts them after reordering
+	switch(color_order) {
+		case COLOR_ORDER::RGB: r_shift =  0; g_shift = 10; b_shift = 20; break;
+		case COLOR_ORDER::RBG: r_shift =  0; g_shift = 20; b_shift = 10; break;
+		case COLOR_ORDER::GRB: r_shift = 10; g_shift =  0; b_shift = 20; break;
+		case COLOR_ORDER::GBR: r_shift = 20; g_shift =  0; b_shift = 10; break;
+		case COLOR_ORDER::BRG: r_shift = 10; g_shift = 20; b_shift =  0; break;
+		case COLOR_ORDER::BGR: r_shift = 20; g_shift = 10; b_shift =  0; break;
+	}
+	lut_gamma = correctGamma;
+	row_hashed[0] = row_hashed[1] = 0;
+	for (uint i = 0; i < 256; i++) {
+		Pixel v = correctGamma ? gamma[i] : i;
+		lut_r[i] = v << r_shift;
+		lut_g[i] = v << g_shift;
+		lut_b[i] = v << b_shift;
+	}
+	for (uint i = 0; i < 32; i++) {
+		lut565_r[i] = lut_r[i << 3];
+		lut565_b[i] = lut_b[i << 3];
+	}
+	for (uint i = 0; i < 64; i++) {
+		lut565_g[i] = lut_g[i << 2];
+	}
+	for (uint i = 0; i < 256; i++) {
+		palette[i] = lut_r[palette_rgb[i][0]] | lut_g[palette_rgb[i][1]] | lut_b[palette_rgb[i][2]];
 	}
 }
 
+void Hub75::set_palette(uint first, const uint8_t *rgb, uint n) {
+	check_luts();
+	for (uint i = first; i < first + n && i < 256; i++, rgb += 3) {
+		palette_rgb[i][0] = rgb[0];
+		palette_rgb[i][1] = rgb[1];
+		palette_rgb[i][2] = rgb[2];
+		palette[i] = lut_r[rgb[0]] | lut_g[rgb[1]] | lut_b[rgb[2]];
+	}
+	// the same indices don't give the same row any more
+	row_hashed[0] = row_hashed[1] = 0;
+}
+
+// Fewer bit planes give a proportionally higher refresh rate (e.g. for panels that are filmed),
+// at the cost of colour resolution. Takes effect at a refresh boundary. Pixels drawn before the
+// change keep their old gamma rounding until redrawn.
+bool Hub75::set_bit_depth(uint depth) {
+	if (depth < 1 || depth > max_bit_depth) {
+		return false;
+	}
+	if (depth == bit_depth) {
+		return true;
+	}
+	wait_for_swap();
+	uint old_depth = bit_depth;
+	bit_depth = depth;
+	planes_dirty[0] = planes_dirty[1] = ~0u;
+	update_gamma();
+	update_schedule();
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		shift_planes(old_depth);
+	}
+	rescan();
+	return true;
+}
+
+// Splits the top plane into `slices` (a power of 2, up to MAX_BCM_SLICES) interleaved on-times,
+// see update_schedule(). 1 scans the planes one after the other. Takes effect at a refresh boundary.
+bool Hub75::set_bcm_slices(uint slices) {
+	if (slices < 1 || slices > MAX_BCM_SLICES || (slices & (slices - 1))) {
+		return false;
+	}
+	if (slices == bcm_slices) {
+		return true;
+	}
+	wait_for_swap();
+	bcm_slices = slices;
+	update_schedule();
+	rescan();
+	return true;
+}
+
+// Leaves the (plane, row) pairs without any lit LED out of the scan. The remaining pulses keep
+// their binary weights, so colours within a frame are right, but the refresh gets shorter by the
+// time of the skipped pulses. The duty cycle of every lit LED rises by the same factor, so
+// brightness follows the content: a frame that lights one row pair of a 32 row scan comes out
+// about 32 times brighter than a full one. Worth turning on where a faster refresh and less DMA
+// traffic matter more than steady brightness. Takes effect at a refresh boundary.
+void Hub75::set_skip_empty(bool skip) {
+	if (skip == skip_empty) {
+		return;
+	}
+	wait_for_swap();
+	skip_empty = skip;
+	rescan();
+}
+
+// The planes are the top bits of the Pixels, so they move with the bit depth. Rebuilds the
+// back planes from the ones on display (not from the canvas, which may hold half a frame):
+// plane p of old_depth is plane p + bit_depth - old_depth now, the ones below come out unlit
+// until the next present().
+void Hub75::shift_planes(uint old_depth) {
+	uint plane_size = rows * width;
+	uint front = front_planes > back_planes;
+	for (uint p = 0; p < bit_depth; p++) {
+		uint8_t *dst = back_planes + p * plane_size;
+		if (p + old_depth >= bit_depth) {
+			memcpy (dst, front_planes + (p + old_depth - bit_depth) * plane_size, plane_size);
+		} else {
+			memset (dst, 0, plane_size);
+		}
+	}
+	for (uint y = 0; y < rows; y++) {
+		uint lit = planes_lit[front][y];
+		lit = bit_depth > old_depth ? lit << (bit_depth - old_depth) : lit >> (old_depth - bit_depth);
+		planes_lit[!front][y] = lit;
+	}
+}
+
+// Rebuilds the scan list of the frame on display, after the bit depth or schedule changed.
+// Nothing new gets presented: an update under way carries on, and the frame a delta is based
+// on is still the one shown.
+void Hub75::rescan() {
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		uint front = front_planes > back_planes;
+		if (front_list->skip != BIT_DEPTH - bit_depth) {
+			// see shift_planes()
+			memcpy (row_planes, planes_lit[!front], sizeof(row_planes));
+			build_scan_list(back_list, back_planes);
+		} else {
+			memcpy (row_planes, planes_lit[front], sizeof(row_planes));
+			build_scan_list(back_list, front_planes);
+			swap_list_only = true;
+		}
+	} else {
+		// Keep showing the front buffer, just rescan it
+		if (skip_empty) {
+			pixels_occupancy(front_buffer, width, rows);
+		}
+		build_scan_list(back_list, front_buffer);
+		swap_list_only = true;
+	}
+	queue_swap(true);
+}
+
+void Hub75::set_brightness(uint value) {
+	brightness = value;
+	update_row_words(front_list);
+	update_row_words(back_list);
+}
+
 void Hub75::stop(irq_handler_t handler) {
 
 	irq_set_enabled(DMA_IRQ_0, false);
@@ -144,26 +554,36 @@ void Hub75::stop(irq_handler_t handler) {
 		dma_channel_set_irq0_enabled(dma_channel, false);
 		irq_remove_handler(DMA_IRQ_0, handler);
 		//dma_channel_wait_for_finish_blocking(dma_channel);
-		dma_channel_abort(dma_channel);
-		dma_channel_acknowledge_irq0(dma_channel);
-		dma_channel_unclaim(dma_channel);
+		unchain_dma_channel(dma_channel);
+		release_dma_channel(dma_data_ctrl_channel);
+		release_dma_channel(dma_channel);
+		release_dma_channel(dma_row_channel);
+		dma_channel = -1;
+		dma_row_channel = -1;
+		dma_data_ctrl_channel = -1;
+	}
+	if (swap_pending) {
+		swap_pending = false;
+		swap_buffers();
 	}
 
 	if(pio_sm_is_claimed(pio, sm_data)) {
 		pio_sm_set_enabled(pio, sm_data, false);
 		pio_sm_drain_tx_fifo(pio, sm_data);
-		pio_remove_program(pio, &hub75_data_rgb888_program, data_prog_offs);
+		pio_remove_program(pio, data_program(), data_prog_offs);
 		pio_sm_unclaim(pio, sm_data);
 	}
 
+	if(chains == 2 && pio_sm_is_claimed(pio, sm_data2)) {
+		pio_sm_set_enabled(pio, sm_data2, false);
+		pio_sm_drain_tx_fifo(pio, sm_data2);
+		pio_sm_unclaim(pio, sm_data2);
+	}
+
 	if(pio_sm_is_claimed(pio, sm_row)) {
 		pio_sm_set_enabled(pio, sm_row, false);
 		pio_sm_drain_tx_fifo(pio, sm_row);
-		if (inverted_stb) {
-			pio_remove_program(pio, &hub75_row_inverted_program, row_prog_offs);
-		} else {
-			pio_remove_program(pio, &hub75_row_program, row_prog_offs);
-		}
+		pio_remove_program(pio, row_program(), row_prog_offs);
 		pio_sm_unclaim(pio, sm_row);
 	}
 
@@ -171,43 +591,185 @@ void Hub75::stop(irq_handler_t handler) {
 	// since we don't know what the PIO might have done with it
 	gpio_put_masked(0b111111 << pin_r0, 0);
 	gpio_put_masked(0b11111 << pin_row_a, 0);
+	if (chains == 2) {
+		gpio_put_masked(0b111111 << pin_chain2_data, 0);
+	}
 	gpio_put(pin_clk, !clk_polarity);
 	gpio_put(pin_clk, !oe_polarity);
 }
 
 void Hub75::dma_complete() {
-	if(dma_channel_get_irq0_status(dma_channel)) {
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		refresh_complete();
+	} else {
+		pixel_row_complete(width);
+	}
+}
+
+// BIT_PLANES mode DMA interrupt, once per refresh
+void Hub75::refresh_complete() {
+	if (dma_channel_get_irq0_status(dma_channel)) {
+		uint32_t start = cycle_count();
 		dma_channel_acknowledge_irq0(dma_channel);
+		if (pio->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + sm_data))) {
+			stats.missed++;
+		}
+		uint32_t txover = 1u << (PIO_FDEBUG_TXOVER_LSB + sm_data2);
+		if (chains == 2 && (pio->fdebug & txover)) {
+			// a word of the second chain found its FIFO full, see setup_scan_chain()
+			pio->fdebug = txover;
+			stats.missed++;
+		}
+		if (swap_pending) {
+			swap_buffers();
+			swap_pending = false;
+		}
+		vsync_count++;
+		serve_stats();
+		start_scan_list();
+		record_isr(start);
+	}
+}
 
-		// Push out a dummy pixel for each row
-		pio_sm_put_blocking(pio, sm_data, 0);
-		pio_sm_put_blocking(pio, sm_data, 0);
+// Returns the counters since the previous reset, and restarts them if asked to. While the panel
+// scans out, the interrupt handler takes the copy at the next refresh boundary: it may run on
+// the other core (DISPLAY_IRQ_CORE), where disabling interrupts here wouldn't keep it out.
+// Not for an interrupt handler, it would wait for up to a refresh.
+Hub75::ScanStats Hub75::read_stats(bool reset) {
+	if (dma_channel == -1) {
+		take_stats(reset);
+		return stats_copy;
+	}
+	stats_request = reset ? 2 : 1;
+	while (stats_request) {
+		tight_loop_contents();
+	}
+	__dmb();	// the all clear before the copy
+	return stats_copy;
+}
 
-		// SM is finished when it stalls on empty TX FIFO
-		hub75_wait_tx_stall(pio, sm_data);
+void Hub75::swap_buffers() {
+	std::swap(front_list, back_list);
+	if (swap_list_only) {
+		swap_list_only = false;
+	} else if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		std::swap(front_planes, back_planes);
+	} else {
+		std::swap(front_buffer, back_buffer);
+		back_stale = true;
+	}
+}
 
-		// Check that previous OEn pulse is finished, else things WILL get out of sequence
-		hub75_wait_tx_stall(pio, sm_row);
+// Waits for a pending swap (we must not draw into a buffer that is about to be shown) and
+// returns the back buffer. Pass keep_contents if only parts of the image get redrawn, so that
+// the back buffer gets refreshed from the front buffer first.
+Pixel *Hub75::begin_update(bool keep_contents) {
+	Pixel *buffer = begin_row_update(keep_contents);
+	forget_rows(back_buffer > front_buffer);
+	return buffer;
+}
 
-		// Latch row data, pulse output enable for new row.
-		pio_sm_put_blocking(pio, sm_row, row | (brightness << 5 << bit));
+Pixel *Hub75::begin_row_update(bool keep_contents) {
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		// the Pixel buffer is never scanned out, present() takes care of the plane buffers
+		return back_buffer;
+	}
+	wait_for_swap();
+	if (keep_contents && back_stale) {
+		memcpy (back_buffer, front_buffer, width * height * sizeof(*back_buffer));
+		uint back = back_buffer > front_buffer;
+		memcpy (row_hash[back], row_hash[!back], sizeof(row_hash[back]));
+		row_hashed[back] = row_hashed[!back];
+	}
+	back_stale = false;
+	return back_buffer;
+}
 
-		row++;
+bool Hub75::row_unchanged(uint y, uint32_t hash) {
+	check_luts();	// rows converted with other tables don't count
+	uint buffer = back_buffer > front_buffer;
+	uint64_t bit = 1ull << y;
+	if ((row_hashed[buffer] & bit) && row_hash[buffer][y] == hash) {
+		row_stats.skipped++;
+		return true;
+	}
+	row_hash[buffer][y] = hash;
+	row_hashed[buffer] |= bit;
+	planes_dirty[0] |= 1u << (y % rows);
+	planes_dirty[1] |= 1u << (y % rows);
+	row_stats.converted++;
+	return false;
+}
 
-		if(row == height / 2) {
-			row = 0;
-			bit++;
-			if (bit == BIT_DEPTH) {
-				bit = 0;
-			}
-			hub75_data_rgb888_set_shift(pio, data_prog_offs, bit);
+void Hub75::row_changed(uint y) {
+	row_hashed[back_buffer > front_buffer] &= ~(1ull << y);
+	planes_dirty[0] |= 1u << (y % rows);
+	planes_dirty[1] |= 1u << (y % rows);
+}
+
+Hub75::RowStats Hub75::read_row_stats(bool reset) {
+	RowStats s = row_stats;
+	if (reset) {
+		row_stats = {};
+	}
+	return s;
+}
+
+// For an update that gets abandoned half way: the back buffer no longer holds a complete
+// frame. In BIT_PLANES mode the display is unaffected, but the canvas keeps what was drawn.
+void Hub75::discard_update() {
+	if (scan_mode == SCAN_MODE::PIXELS) {
+		back_stale = true;
+	}
+}
+
+// Hands the back buffer over to the display. The swap happens in dma_complete() once the
+// current refresh has finished, so a frame is never shown half old, half new.
+void Hub75::present(bool wait) {
+	wait_for_swap();
+	if (scan_mode == SCAN_MODE::BIT_PLANES) {
+		convert_to_planes();
+		build_scan_list(back_list, back_planes);
+	} else {
+		if (skip_empty) {
+			pixels_occupancy(back_buffer, width, rows);
 		}
+		build_scan_list(back_list, back_buffer);
+	}
+	present_count++;
+	queue_swap(wait);
+}
+
+void Hub75::queue_swap(bool wait) {
+	if (dma_channel == -1) {
+		// not scanning out (yet), so there's nobody to do the swap for us
+		swap_buffers();
+		return;
+	}
+	swap_pending = true;
+	if (wait) {
+		wait_for_swap();
+	}
+}
+
+void Hub75::wait_for_swap() {
+	while (swap_pending) {
+		tight_loop_contents();
+	}
+}
 
-		dma_channel_set_trans_count(dma_channel, width * 2, false);
-		dma_channel_set_read_addr(dma_channel, &back_buffer[row * width * 2], true);
+// Can be used to pace frame output to the display refresh
+void Hub75::wait_for_vsync() {
+	uint32_t count = vsync_count;
+	while (count == vsync_count) {
+		tight_loop_contents();
 	}
 }
 
+void Hub75::convert_to_planes() {
+	planes_from_pixels(width, rows, chains);
+}
+
 void Hub75::clear() {
 	#if 1
 		memset (back_buffer, 0, width * height * sizeof(*back_buffer));
@@ -221,39 +783,33 @@ void Hub75::clear() {
 }
 
 void Hub75::set_color(uint x, uint y, Pixel c) {
-	int offset = 0;
 	if (x >= width || y >= height) return;
 	// flip x
 	//x = width - 1 - x;
 	// flip y
 	//y = height - 1 - y;
-	if (y >= height / 2) {
-		y -= height / 2;
-		offset = 1;
-	}
-	offset += (y * width + x) * 2;
-	back_buffer[offset] = c;
+	back_buffer[buffer_offset(width, height, x, y)] = c;
 }
 
 void Hub75::set_pixel(uint x, uint y, uint8_t r, uint8_t g, uint8_t b) {
 	switch(color_order) {
 		case COLOR_ORDER::RGB:
-			set_color(x, y, makePixel(r, g, b));
+			set_color(x, y, make_ordered_pixel<COLOR_ORDER::RGB>(r, g, b));
 			break;
 		case COLOR_ORDER::RBG:
-			set_color(x, y, makePixel(r, b, g));
+			set_color(x, y, make_ordered_pixel<COLOR_ORDER::RBG>(r, g, b));
 			break;
 		case COLOR_ORDER::GRB:
-			set_color(x, y, makePixel(g, r, b));
+			set_color(x, y, make_ordered_pixel<COLOR_ORDER::GRB>(r, g, b));
 			break;
 		case COLOR_ORDER::GBR:
-			set_color(x, y, makePixel(g, b, r));
+			set_color(x, y, make_ordered_pixel<COLOR_ORDER::GBR>(r, g, b));
 			break;
 		case COLOR_ORDER::BRG:
-			set_color(x, y, makePixel(b, r, g));
+			set_color(x, y, make_ordered_pixel<COLOR_ORDER::BRG>(r, g, b));
 			break;
 		case COLOR_ORDER::BGR:
-			set_color(x, y, makePixel(b, g, r));
+			set_color(x, y, make_ordered_pixel<COLOR_ORDER::BGR>(r, g, b));
 			break;
 	}
 }
@@ -293,32 +849,54 @@ void Hub75::show_5x7_string (uint x, uint y, const char *format, ...) {
 	show_5x7_string (x, y, msg, makePixel(100,100,100), black);
 }
 
+// The colour order is resolved once per frame instead of once per pixel
 void Hub75::updateFromRGB888(void *graphics, bool bigEndian) {
-	uint32_t *p = (uint32_t *)graphics;
-	for (uint y = 0; y < height; y++) {
-		for (uint x = 0; x < width; x++) {
-			uint32_t col = *p;
-			if (bigEndian) col = __builtin_bswap32(col);
-			uint8_t r = (col & 0xff0000) >> 16;
-			uint8_t g = (col & 0x00ff00) >>  8;
-			uint8_t b = (col & 0x0000ff) >>  0;
-			set_pixel(x, y, r, g, b);
-			p++;
-		}
-	}
+	rgb888_to_buffer((const uint8_t *)graphics, width, height, bigEndian);
 }
 
 void Hub75::updateFromRGB565(void *graphics, bool bigEndian) {
-	uint16_t *p = (uint16_t *)graphics;
-	for(uint y = 0; y < height; y++) {
-		for(uint x = 0; x < width; x++) {
-			uint16_t col = *p;
-			if (bigEndian) col = __builtin_bswap16(col);
-			uint8_t r = (col & 0b1111100000000000) >> 8;
-			uint8_t g = (col & 0b0000011111100000) >> 3;
-			uint8_t b = (col & 0b0000000000011111) << 3;
-			set_pixel(x, y, r, g, b);
-			p++;
-		}
+	rgb565_to_buffer((const uint8_t *)graphics, width, height, bigEndian);
+}
+
+bool Hub75::updateFromNative(uint offset, const uint8_t *src, uint len) {
+	uint size = width * height * sizeof(Pixel);
+	if (offset > size || len > size - offset) {
+		return false;
 	}
+	memcpy ((uint8_t *)back_buffer + offset, src, len);
+	return true;
+}
+
+void Hub75::updateRowFromRGB888(uint y, const uint8_t *src, bool bigEndian) {
+	check_luts();
+	rgb888_row_to_buffer(src, width, height, 0, y, width, bigEndian);
+}
+
+void Hub75::updateRowFromRGB565(uint y, const uint8_t *src, bool bigEndian) {
+	check_luts();
+	rgb565_row_to_buffer(src, width, height, 0, y, width, bigEndian);
+}
+
+void Hub75::updateSpanFromRGB888(uint x, uint y, uint n, const uint8_t *src, bool bigEndian) {
+	if (x >= width || y >= height || n > width - x) return;
+	check_luts();
+	rgb888_row_to_buffer(src, width, height, x, y, n, bigEndian);
+}
+
+void Hub75::updateSpanFromRGB565(uint x, uint y, uint n, const uint8_t *src, bool bigEndian) {
+	if (x >= width || y >= height || n > width - x) return;
+	check_luts();
+	rgb565_row_to_buffer(src, width, height, x, y, n, bigEndian);
+}
+
+void Hub75::updateSpanFromIndexed(uint x, uint y, uint n, const uint8_t *src, uint bits) {
+	if (x >= width || y >= height || n > width - x) return;
+	check_luts();
+	indexed_row_to_buffer(src, width, height, x, y, n, bits);
+}
+
+void Hub75::updateRowFromYCbCr(uint y, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr) {
+	if (y >= height) return;
+	check_luts();
+	ycbcr_row_to_buffer(luma, cb, cr, width, height, y);
 }
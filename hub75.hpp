@@ -1,9 +1,14 @@
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cassert>
 #include "pico/stdlib.h"
 
 #include "hardware/pio.h"
 #include "hardware/dma.h"
 #include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
 
 #include "hub75.pio.h"
 
@@ -12,6 +17,10 @@ const uint DATA_N_PINS = 6;
 const uint ROWSEL_BASE_PIN = 6;
 const uint ROWSEL_N_PINS = 5;
 const uint BIT_DEPTH = 10;
+const uint MAX_BCM_SLICES = 4;	// see Hub75::set_bcm_slices()
+
+// Upper bound of the plane passes in a refresh, see Hub75::update_schedule()
+constexpr uint max_passes(uint bit_depth) { return bit_depth + 2 * MAX_BCM_SLICES; }
 
 // This gamma table is used to correct our 8-bit (0-255) colours up to 11-bit,
 // allowing us to gamma correct without losing dynamic range.
@@ -52,22 +61,114 @@ class Hub75 {
 		BRG,
 		BGR
 	};
+	// PIXELS:     DMA sends the Pixel buffer BIT_DEPTH times per refresh, the data SM picks the bit.
+	// BIT_PLANES: present() converts the Pixel buffer into packed bit planes (one byte per
+	//             column: R0 G0 B0 R1 G1 B1), which need 1/8th of the DMA traffic.
+	enum class SCAN_MODE {
+		PIXELS,
+		BIT_PLANES
+	};
 	uint width;
 	uint height;
-	Pixel *back_buffer;
+	uint rows;				// row addresses, each driving one row in the top and one in the bottom half
+	uint chains;			// BIT_PLANES mode: 2 drives the right half of the width from a second set of data pins
+	uint bit_depth;			// number of bit planes scanned out, taken from the top of the 10 bit channels
+	uint max_bit_depth;		// the buffers are sized for this many planes
+	uint16_t gamma[256];	// GAMMA_10BIT rounded to bit_depth bits, see set_bit_depth()
+	// Conversion tables with gamma, colour order and channel position baked in, see update_luts().
+	// OR-ing one entry of each gives the Pixel.
+	Pixel lut_r[256], lut_g[256], lut_b[256];
+	Pixel lut565_r[32], lut565_g[64], lut565_b[32];
+	// For the indexed formats, see set_palette()
+	uint8_t palette_rgb[256][3] = {};
+	Pixel palette[256];
+	bool lut_gamma;			// correctGamma when the tables were built
+	uint bcm_slices = 1;	// the top plane is scanned in this many slices, see set_bcm_slices()
+	SCAN_MODE scan_mode;
+	Pixel *front_buffer;	// being scanned out by DMA (same as back_buffer in BIT_PLANES mode)
+	Pixel *back_buffer;		// inactive buffer, all drawing and conversion goes here
 	bool managed_buffer = false;
+	uint8_t *front_planes = nullptr;	// BIT_PLANES mode only: [bit][row][column]
+	uint8_t *back_planes = nullptr;
+	bool managed_planes = false;
 	PanelType panel_type;
 	bool inverted_stb = false;
 	COLOR_ORDER color_order;
 	Pixel background = 0;
 
+	// Plane passes of a refresh, see update_schedule(). Each pass scans all rows of one plane.
+	struct SchedulePass {
+		uint8_t plane;
+		uint8_t shift;			// OEn pulse width is brightness << shift
+	};
+	SchedulePass schedule[max_passes(BIT_DEPTH)];
+	uint schedule_length = 0;
+
+	// The row pulses of one refresh, in scan order. present() builds one for the back buffer,
+	// and it gets swapped in together with it.
+	struct ScanList {
+		const void **data;		// per entry: row pair in the Pixel buffer, or plane row in BIT_PLANES mode; nullptr terminated
+		uint32_t *row_words;	// per entry: sm_row record, row select in the low 5 bits, OEn pulse width above
+		uint8_t *planes;		// per entry: bit plane
+		uint8_t *shifts;		// per entry: OEn pulse width is brightness << shift
+		uint count;
+		uint skip;				// Pixel bits below the scanned planes (BIT_DEPTH - bit_depth)
+	};
+	// Capacity each ScanList needs
+	static constexpr uint scan_entries(uint bit_depth, uint rows) { return max_passes(bit_depth) * rows; }
+	ScanList *front_list = nullptr;
+	ScanList *back_list = nullptr;
+	bool managed_lists = false;
+	uint16_t row_planes[32];	// occupancy of the back buffer: bit p set if plane p of that row has any lit LED
+	bool skip_empty = false;	// leave unlit (plane, row) pairs out of the scan, see set_skip_empty()
+
+	// Unchanged rows, see row_unchanged()
+	uint32_t row_hash[2][64];				// per Pixel buffer: hash of the input row y was converted from
+	uint64_t row_hashed[2] = {0, 0};		// per Pixel buffer: bit y set if row_hash[][y] is valid
+	uint32_t planes_dirty[2] = {~0u, ~0u};	// per plane buffer: bit y set if row pair y changed since its conversion
+	uint16_t planes_lit[2][32] = {};		// per plane buffer: row_planes of the row pairs as converted
+	struct RowStats {
+		uint32_t converted;		// input rows converted after row_unchanged()
+		uint32_t skipped;		// and left as they were
+		uint32_t plane_rows;	// row pairs converted to planes
+		uint32_t plane_rows_skipped;
+	};
+	RowStats row_stats = {};
+
+	// Buffer swap, see present()
+	volatile bool swap_pending = false;
+	volatile uint32_t vsync_count = 0;	// incremented at every refresh boundary (row 0, bit 0)
+	uint32_t present_count = 0;			// frames handed over for display
+	bool back_stale = false;			// back buffer holds the frame before the front one
+
 	// DMA & PIO
 	int dma_channel = -1;
-	uint bit = 0;
-	uint row = 0;
+	// BIT_PLANES mode: scan-out runs from DMA, see setup_scan_chain()
+	int dma_row_channel = -1;
+	int dma_data_ctrl_channel = -1;
+	uint entry = 0;		// PIXELS mode: position in front_list
+	// Scan-out instrumentation, times in system clock cycles (SysTick), see read_stats()
+	struct ScanStats {
+		uint32_t refreshes;
+		uint32_t isr_count;
+		uint32_t isr_min;
+		uint32_t isr_max;
+		uint64_t isr_total;
+		uint64_t stall_data;	// spent waiting for sm_data / sm_row in the interrupt handler
+		uint64_t stall_row;
+		uint32_t missed;		// sm_data ran dry before the interrupt handler fed it, or sm_data2 lost a word
+		uint32_t elapsed_us;	// since the previous read_stats(true)
+	};
+	ScanStats stats = {};				// written by the interrupt handler, see read_stats()
+	ScanStats stats_copy = {};
+	volatile uint stats_request = 0;	// read_stats() is waiting for stats_copy: 1, and a reset: 2
+	uint32_t stats_since_us = 0;
+	uint32_t stats_since_vsync = 0;
+	uint data_shift = 0;	// PIXELS mode: Pixel bit hub75_data_rgb888 is set up for (skip + plane of the list)
 
 	PIO pio = pio0;
 	uint sm_data = 0;
+	uint sm_data2 = 1;	// second chain only, sm_row moves to 2 then
 	uint sm_row = 1;
 
 	uint data_prog_offs = 0;
@@ -97,6 +198,12 @@ class Hub75 {
 	unsigned int pin_stb = 12;    // Strobe/Latch
 	unsigned int pin_oe = 13;     // Output Enable
 
+	// Second chain: R0 G0 B0 R1 G1 B1 from here on, and its own clock. Row select, latch
+	// and output enable are shared with the first chain. Given to the constructor, as which
+	// pins are free depends on the board.
+	unsigned int pin_chain2_data;
+	unsigned int pin_chain2_clk;
+
 	const bool clk_polarity = 1;
 	const bool stb_polarity = 1;
 	const bool oe_polarity = 0;
@@ -112,7 +219,16 @@ class Hub75 {
 	Hub75(uint width, uint height) : Hub75(width, height, nullptr) {};
 	Hub75(uint width, uint height, Pixel *buffer) : Hub75(width, height, buffer, PANEL_GENERIC) {};
 	Hub75(uint width, uint height, Pixel *buffer, PanelType panel_type) : Hub75(width, height, buffer, panel_type, false) {};
-	Hub75(uint width, uint height, Pixel *buffer, PanelType panel_type, bool inverted_stb, COLOR_ORDER color_order=COLOR_ORDER::RGB);
+	Hub75(uint width, uint height, Pixel *buffer, PanelType panel_type, bool inverted_stb, COLOR_ORDER color_order=COLOR_ORDER::RGB, SCAN_MODE scan_mode=SCAN_MODE::PIXELS)
+	 : Hub75(width, height, buffer, nullptr, nullptr, panel_type, inverted_stb, color_order, scan_mode, BIT_DEPTH) {};
+	// If given, `buffer` must hold two frames (width * height * 2 Pixels) for the front and back buffer,
+	// or one frame in BIT_PLANES mode. In BIT_PLANES mode, `planes` must hold bit_depth * width * height
+	// bytes (two sets of planes). `lists` are the two ScanLists, with room for scan_entries(bit_depth,
+	// height / 2) entries (plus the terminator in `data`). `bit_depth` is the maximum for set_bit_depth().
+	// With 2 `chains` (BIT_PLANES mode only), the left half of `width` is shifted out on the usual data
+	// pins and the right half on 6 consecutive pins from `chain2_data` in parallel, clocked by `chain2_clk`,
+	// so the refresh rate stays that of one chain.
+	Hub75(uint width, uint height, Pixel *buffer, uint8_t *planes, ScanList *lists, PanelType panel_type, bool inverted_stb, COLOR_ORDER color_order, SCAN_MODE scan_mode, uint bit_depth, uint chains = 1, uint chain2_data = 0, uint chain2_clk = 0);
 	~Hub75();
 
 	void FM6126A_write_register(uint16_t value, uint8_t position);
@@ -122,9 +238,47 @@ class Hub75 {
 	void set_pixel(uint x, uint y, uint8_t r, uint8_t g, uint8_t b);
 	void display_update();
 	void clear();
+
+	// Double buffering: draw into the back buffer between begin_update() and present().
+	// The buffers are swapped by dma_complete() at the next refresh boundary.
+	Pixel *begin_update(bool keep_contents);
+	// begin_update() for converters that write whole rows, asking row_unchanged() first. It keeps
+	// the row hashes of the back buffer, which begin_update() has to forget.
+	Pixel *begin_row_update(bool keep_contents);
+	// True if row y of the back buffer already holds the input with this hash, so it needn't be
+	// converted again. Otherwise records the hash for the row that is about to be converted.
+	bool row_unchanged(uint y, uint32_t hash);
+	// For a part of row y drawn after begin_row_update()
+	void row_changed(uint y);
+	// For row_unchanged(). A 32 bit hash, so two different rows will be taken as the same one in
+	// about 4 billion.
+	static inline uint32_t hash_row(const uint8_t *p, uint len, uint32_t seed) {
+		uint32_t h = seed ^ len;
+		for (; len >= 4; len -= 4) {
+			uint32_t v;
+			memcpy (&v, p, 4);
+			p += 4;
+			h = (h ^ v) * 0x9e3779b1;
+			h ^= h >> 15;
+		}
+		for (; len; len--) {
+			h = (h ^ *p++) * 0x9e3779b1;
+		}
+		return h ^ (h >> 16);
+	}
+	RowStats read_row_stats(bool reset);
+	void present(bool wait = false);
+	void wait_for_swap();
+	void wait_for_vsync();
+	void convert_to_planes();
 	void start(irq_handler_t handler);
 	void stop(irq_handler_t handler);
 	void dma_complete();
+	void set_brightness(uint value);
+	bool set_bit_depth(uint depth);
+	bool set_bcm_slices(uint slices);
+	void set_skip_empty(bool skip);
+	ScanStats read_stats(bool reset);
 	
 	void show_5x7_char   (uint x, uint y, unsigned char c, Pixel fg, Pixel bg);
 	void show_5x7_string (uint x, uint y, const char *format, ...);
@@ -136,9 +290,463 @@ class Hub75 {
 	static constexpr Pixel black = 0;
 	Pixel makePixel (uint32_t px) { return makePixel (px >> 24, px >> 16, px >> 8); };
 	Pixel makePixel (uint8_t r, uint8_t g, uint8_t b) {
-		return correctGamma ? (GAMMA_10BIT[b] << 20) | (GAMMA_10BIT[g] << 10) | GAMMA_10BIT[r] : (b << 20) | (g << 10) | r;
+		return correctGamma ? (gamma[b] << 20) | (gamma[g] << 10) | gamma[r] : (b << 20) | (g << 10) | r;
 	};
 
 	void updateFromRGB565(void *graphics, bool bigEndian);
 	void updateFromRGB888(void *graphics, bool bigEndian);
+	// One row of `width` pixels, read byte by byte (so `src` needs no alignment)
+	void updateRowFromRGB565(uint y, const uint8_t *src, bool bigEndian);
+	void updateRowFromRGB888(uint y, const uint8_t *src, bool bigEndian);
+	// Copies `len` bytes to byte `offset` of the back buffer: little endian Pixels in buffer order
+	// (rows y and y + height/2 interleaved), with gamma and colour order already applied. Bits
+	// 30-31 must be 0. Returns false, copying nothing, if it would go past the end.
+	bool updateFromNative(uint offset, const uint8_t *src, uint len);
+	// n pixels from x, y (within the canvas, or nothing is drawn)
+	void updateSpanFromRGB565(uint x, uint y, uint n, const uint8_t *src, bool bigEndian);
+	void updateSpanFromRGB888(uint x, uint y, uint n, const uint8_t *src, bool bigEndian);
+	// Palette entries `first` on, from n RGB888 triplets. Rows drawn with the old colours need
+	// redrawing (so it changes nothing on the panel by itself).
+	void set_palette(uint first, const uint8_t *rgb, uint n);
+	// Palette indices of 8 or 4 bits (two pixels per byte, the left one in the high nibble)
+	void updateSpanFromIndexed(uint x, uint y, uint n, const uint8_t *src, uint bits);
+	// YCbCr 4:2:0 (BT.601, limited range): rows 2k and 2k + 1 share row k of the chroma planes,
+	// which have a sample for every two columns
+	void updateRowFromYCbCr(uint y, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr);
+	void discard_update();
+
+	protected:
+	void build_scan_list(ScanList *list, const void *frame);
+	void queue_swap(bool wait);
+	bool swap_list_only = false;	// rescan() keeps the frame on display, only its list changes
+
+	// The hot paths take the geometry as arguments and are inlined, so that the runtime class
+	// gets them with its member values, and Hub75Panel with its template constants.
+
+	// Rows of the top and bottom half are interleaved, as they are shifted out together
+	static inline uint buffer_offset(uint w, uint h, uint x, uint y) {
+		return y >= h / 2 ? ((y - h / 2) * w + x) * 2 + 1 : (y * w + x) * 2;
+	}
+
+	template <COLOR_ORDER order>
+	inline Pixel make_ordered_pixel(uint8_t r, uint8_t g, uint8_t b) {
+		switch(order) {
+			case COLOR_ORDER::RGB: return makePixel(r, g, b);
+			case COLOR_ORDER::RBG: return makePixel(r, b, g);
+			case COLOR_ORDER::GRB: return makePixel(g, r, b);
+			case COLOR_ORDER::GBR: return makePixel(g, b, r);
+			case COLOR_ORDER::BRG: return makePixel(b, r, g);
+			case COLOR_ORDER::BGR: return makePixel(b, g, r);
+		}
+		return black;
+	}
+
+	// correctGamma is public, so the tables are checked once per conversion
+	inline void check_luts() {
+		if (lut_gamma != correctGamma) {
+			update_luts();
+		}
+	}
+
+	inline void rgb565_to_buffer(const uint8_t *p, uint w, uint h, bool bigEndian) {
+		check_luts();
+		for (uint y = 0; y < h; y++) {
+			rgb565_row_to_buffer(p, w, h, 0, y, w, bigEndian);
+			p += w * 2;
+		}
+	}
+
+	inline void rgb888_to_buffer(const uint8_t *p, uint w, uint h, bool bigEndian) {
+		check_luts();
+		for (uint y = 0; y < h; y++) {
+			rgb888_row_to_buffer(p, w, h, 0, y, w, bigEndian);
+			p += w * 4;
+		}
+	}
+
+	// `lit` is Pixels OR-ed together and shifted down by skip. Returns bit p set if plane p is lit.
+	static inline uint lit_planes(uint32_t lit, uint depth) {
+		return (lit | lit >> 10 | lit >> 20) & ((1u << depth) - 1);
+	}
+
+	// Fills row_planes from a Pixel buffer, for PIXELS mode with skip_empty (planes_from_pixels()
+	// does it on the way)
+	inline void pixels_occupancy(const Pixel *src, uint w, uint rows) {
+		uint skip = BIT_DEPTH - bit_depth;
+		for (uint y = 0; y < rows; y++) {
+			uint32_t lit = 0;
+			for (uint x = 0; x < w * 2; x++) {
+				lit |= *src++;
+			}
+			row_planes[y] = lit_planes(lit >> skip, bit_depth);
+		}
+	}
+
+	// Position of column x in a plane row. With two chains, one DMA channel feeds both data SMs
+	// word by word, so their columns are interleaved in groups of four.
+	static inline uint record_column(uint x, uint w, uint chains) {
+		if (chains == 1) {
+			return x;
+		}
+		uint chain = x >= w / 2;
+		uint col = x - chain * (w / 2);
+		return (col & ~3u) * 2 + chain * 4 + (col & 3);
+	}
+
+	// A canvas change outside row_unchanged()
+	inline void forget_rows(uint buffer) {
+		row_hashed[buffer] = 0;
+		planes_dirty[0] = planes_dirty[1] = ~0u;
+	}
+
+	// The row kernels convert n pixels to x, y of a w x h buffer, and leave check_luts() to their
+	// caller. A word aligned row is read a word at a time (two pixels of RGB565), the bytes of
+	// both halves swapped at once for big endian.
+	inline void rgb565_row_to_buffer(const uint8_t *p, uint w, uint h, uint x0, uint y, uint n, bool bigEndian) {
+		Pixel *dst = &back_buffer[buffer_offset(w, h, x0, y)];
+		uint x = 0;
+		if (((uintptr_t)p & 3) == 0) {
+			const uint32_t *q = (const uint32_t *)p;
+			for (; x + 1 < n; x += 2) {
+				uint32_t v = *q++;
+				if (bigEndian) v = ((v >> 8) & 0x00ff00ff) | ((v << 8) & 0xff00ff00);
+				dst[x * 2] = lut565_r[(v >> 11) & 0x1f] | lut565_g[(v >> 5) & 0x3f] | lut565_b[v & 0x1f];
+				dst[x * 2 + 2] = lut565_r[v >> 27] | lut565_g[(v >> 21) & 0x3f] | lut565_b[(v >> 16) & 0x1f];
+			}
+			p = (const uint8_t *)q;
+		}
+		uint hi = bigEndian ? 0 : 1;
+		for (; x < n; x++) {
+			uint col = (p[hi] << 8) | p[hi ^ 1];
+			p += 2;
+			dst[x * 2] = lut565_r[col >> 11] | lut565_g[(col >> 5) & 0x3f] | lut565_b[col & 0x1f];
+		}
+	}
+
+	// 0x00RRGGBB words; byte order only changes the shifts
+	inline void rgb888_row_to_buffer(const uint8_t *p, uint w, uint h, uint x0, uint y, uint n, bool bigEndian) {
+		Pixel *dst = &back_buffer[buffer_offset(w, h, x0, y)];
+		if (((uintptr_t)p & 3) == 0) {
+			const uint32_t *q = (const uint32_t *)p;
+			uint rs = bigEndian ? 8 : 16;
+			uint gs = bigEndian ? 16 : 8;
+			uint bs = bigEndian ? 24 : 0;
+			for (uint x = 0; x < n; x++) {
+				uint32_t v = *q++;
+				dst[x * 2] = lut_r[(v >> rs) & 0xff] | lut_g[(v >> gs) & 0xff] | lut_b[(v >> bs) & 0xff];
+			}
+			return;
+		}
+		uint ri = bigEndian ? 1 : 2;
+		uint gi = bigEndian ? 2 : 1;
+		uint bi = bigEndian ? 3 : 0;
+		for (uint x = 0; x < n; x++) {
+			dst[x * 2] = lut_r[p[ri]] | lut_g[p[gi]] | lut_b[p[bi]];
+			p += 4;
+		}
+	}
+
+	// The palette holds ready Pixels, so this is one lookup per pixel
+	inline void indexed_row_to_buffer(const uint8_t *p, uint w, uint h, uint x0, uint y, uint n, uint bits) {
+		Pixel *dst = &back_buffer[buffer_offset(w, h, x0, y)];
+		if (bits == 8) {
+			for (uint x = 0; x < n; x++) {
+				dst[x * 2] = palette[p[x]];
+			}
+			return;
+		}
+		uint x = 0;
+		for (; x + 1 < n; x += 2) {
+			uint b = *p++;
+			dst[x * 2] = palette[b >> 4];
+			dst[x * 2 + 2] = palette[b & 0x0f];
+		}
+		if (x < n) {
+			dst[x * 2] = palette[*p >> 4];
+		}
+	}
+
+	static inline uint clamp_8bit(int v) {
+		return v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+
+	// Fixed point with 8 fractional bits, the chroma terms worked out once per two pixels
+	inline void ycbcr_row_to_buffer(const uint8_t *luma, const uint8_t *cb, const uint8_t *cr, uint w, uint h, uint y) {
+		Pixel *dst = &back_buffer[buffer_offset(w, h, 0, y)];
+		int r_add = 0, g_add = 0, b_add = 0;
+		for (uint x = 0; x < w; x++) {
+			if (!(x & 1)) {
+				int d = *cb++ - 128;
+				int e = *cr++ - 128;
+				r_add = 409 * e + 128;
+				g_add = -100 * d - 208 * e + 128;
+				b_add = 516 * d + 128;
+			}
+			int c = 298 * (luma[x] - 16);
+			dst[x * 2] = lut_r[clamp_8bit((c + r_add) >> 8)] | lut_g[clamp_8bit((c + g_add) >> 8)] | lut_b[clamp_8bit((c + b_add) >> 8)];
+		}
+	}
+
+	// Splits the Pixel buffer into bit_depth planes of one byte per column and row pair,
+	// bits 0-5 being R0 G0 B0 R1 G1 B1, matching the pin order of hub75_data_planes.
+	inline void planes_from_pixels(uint w, uint rows, uint chains) {
+		uint plane_size = rows * w;
+		uint skip = BIT_DEPTH - bit_depth;
+		const Pixel *src = back_buffer;
+		uint buffer = back_planes > front_planes;
+		uint32_t dirty = planes_dirty[buffer];
+		planes_dirty[buffer] = 0;
+		for (uint y = 0; y < rows; y++) {
+			if (!(dirty & (1u << y))) {
+				// this plane buffer has the row pair already
+				row_planes[y] = planes_lit[buffer][y];
+				row_stats.plane_rows_skipped++;
+				src += w * 2;
+				continue;
+			}
+			uint8_t *dst = &back_planes[y * w];
+			uint32_t lit = 0;
+			for (uint x = 0; x < w; x++) {
+				uint32_t top = src[0] >> skip;
+				uint32_t bottom = src[1] >> skip;
+				src += 2;
+				lit |= top | bottom;
+				uint8_t *d = dst + record_column(x, w, chains);
+				for (uint b = 0; b < bit_depth; b++) {
+					*d = (top & 0x01) | ((top >> 9) & 0x02) | ((top >> 18) & 0x04)
+						| ((bottom << 3) & 0x08) | ((bottom >> 6) & 0x10) | ((bottom >> 15) & 0x20);
+					top >>= 1;
+					bottom >>= 1;
+					d += plane_size;
+				}
+			}
+			row_planes[y] = planes_lit[buffer][y] = lit_planes(lit, bit_depth);
+			row_stats.plane_rows++;
+		}
+	}
+
+	// SysTick counts down from 2^24 - 1 at the system clock, see start()
+	static inline uint32_t cycle_count() {
+		return systick_hw->cvr;
+	}
+
+	static inline uint32_t cycles_between(uint32_t from, uint32_t to) {
+		return (from - to) & 0xffffff;
+	}
+
+	// Copies the counters for read_stats(), and restarts them if asked to
+	inline void take_stats(bool reset) {
+		uint32_t now = time_us_32();
+		stats_copy = stats;
+		stats_copy.refreshes = vsync_count - stats_since_vsync;
+		stats_copy.elapsed_us = now - stats_since_us;
+		if (reset) {
+			stats = {};
+			stats.isr_min = UINT32_MAX;
+			stats_since_vsync = vsync_count;
+			stats_since_us = now;
+		}
+	}
+
+	// At a refresh boundary: a read_stats() that is waiting gets its copy
+	inline void serve_stats() {
+		if (stats_request) {
+			take_stats(stats_request > 1);
+			__dmb();	// the copy before the all clear
+			stats_request = 0;
+		}
+	}
+
+	inline void record_isr(uint32_t start) {
+		uint32_t cycles = cycles_between(start, cycle_count());
+		stats.isr_count++;
+		stats.isr_total += cycles;
+		stats.isr_min = std::min(stats.isr_min, cycles);
+		stats.isr_max = std::max(stats.isr_max, cycles);
+	}
+
+	// PIXELS mode DMA interrupt, once per front_list entry
+	inline void pixel_row_complete(uint w) {
+		if(dma_channel_get_irq0_status(dma_channel)) {
+			uint32_t start = cycle_count();
+			dma_channel_acknowledge_irq0(dma_channel);
+
+			// The tail of the row should still be in the FIFO
+			if (pio_sm_is_tx_fifo_empty(pio, sm_data)) {
+				stats.missed++;
+			}
+
+			// Push out a dummy pixel for each row
+			pio_sm_put_blocking(pio, sm_data, 0);
+			pio_sm_put_blocking(pio, sm_data, 0);
+
+			// SM is finished when it stalls on empty TX FIFO
+			uint32_t t0 = cycle_count();
+			hub75_wait_tx_stall(pio, sm_data);
+			uint32_t t1 = cycle_count();
+			stats.stall_data += cycles_between(t0, t1);
+
+			// Check that previous OEn pulse is finished, else things WILL get out of sequence
+			hub75_wait_tx_stall(pio, sm_row);
+			stats.stall_row += cycles_between(t1, cycle_count());
+
+			// Latch row data, pulse output enable for new row.
+			pio_sm_put_blocking(pio, sm_row, front_list->row_words[entry]);
+
+			entry++;
+
+			if (entry == front_list->count) {
+				entry = 0;
+				// Refresh boundary: the only place where the buffers may be swapped without tearing
+				if (swap_pending) {
+					swap_buffers();
+					swap_pending = false;
+				}
+				vsync_count++;
+				serve_stats();
+			}
+
+			// the whole shift, as a list swapped in by set_bit_depth() has another skip
+			uint entry_shift = front_list->skip + front_list->planes[entry];
+			if (entry_shift != data_shift) {
+				data_shift = entry_shift;
+				hub75_data_rgb888_set_shift(pio, data_prog_offs, data_shift);
+			}
+
+			dma_channel_set_trans_count(dma_channel, w * 2, false);
+			dma_channel_set_read_addr(dma_channel, front_list->data[entry], true);
+			record_isr(start);
+		}
+	}
+
+	void refresh_complete();
+
+	private:
+	const pio_program_t *data_program();
+	const pio_program_t *row_program();
+	void setup_scan_chain(dma_channel_config data_config);
+	void start_scan_list();
+	void update_row_words(ScanList *list);
+	void update_schedule();
+	void shift_planes(uint old_depth);
+	void rescan();
+	void update_gamma();
+	void update_luts();
+	void swap_buffers();
+};
+
+// Hub75 with geometry, bit depth, colour order and scan mode fixed at compile time. All buffers
+// are static (in .bss), and the per-pixel and per-row paths get constant bounds and no colour
+// order switch. These methods hide (not override) the Hub75 ones, so call them through the
+// Hub75Panel type, including from the DMA interrupt handler.
+// The buffers belong to the specialisation, not the object, so there can only be one panel of
+// each (the constructor asserts it). Panels that differ in any template parameter don't share.
+template <uint Width, uint Height, uint BitDepth = BIT_DEPTH, uint Scan = Height / 2,
+		  Hub75::COLOR_ORDER Order = Hub75::COLOR_ORDER::RGB, Hub75::SCAN_MODE Mode = Hub75::SCAN_MODE::BIT_PLANES,
+		  uint Chains = 1>
+class Hub75Panel : public Hub75 {
+	static_assert(Scan * 2 == Height, "the top and bottom half of the panel are scanned together");
+	static_assert(Scan <= 32, "there are only 5 row select lines");
+	static_assert(BitDepth >= 1 && BitDepth <= BIT_DEPTH, "Pixel holds 10 bits per channel");
+	static_assert(Mode == SCAN_MODE::PIXELS || Width % (4 * Chains) == 0, "bit planes hold 4 columns per DMA word");
+	static_assert(Chains == 1 || (Chains == 2 && Mode == SCAN_MODE::BIT_PLANES), "a second chain needs BIT_PLANES mode");
+
+	static constexpr bool planes = Mode == SCAN_MODE::BIT_PLANES;
+	static inline Pixel pixel_storage[planes ? 1 : 2][Width * Height];
+	static inline uint8_t plane_storage[planes ? 2 * BitDepth * Scan * Width : 1];
+	static constexpr uint entries = scan_entries(BitDepth, Scan);
+	static inline const void *scan_data[2][entries + 1];
+	static inline uint32_t scan_row_words[2][entries];
+	static inline uint8_t scan_planes[2][entries];
+	static inline uint8_t scan_shifts[2][entries];
+	static inline ScanList scan_lists[2] = {
+		{scan_data[0], scan_row_words[0], scan_planes[0], scan_shifts[0], 0, 0},
+		{scan_data[1], scan_row_words[1], scan_planes[1], scan_shifts[1], 0, 0}
+	};
+	static inline uint instances = 0;
+
+	public:
+	// `chain2_data` and `chain2_clk` as for Hub75, needed with 2 Chains
+	Hub75Panel(PanelType panel_type = PANEL_GENERIC, bool inverted_stb = false, uint chain2_data = 0, uint chain2_clk = 0)
+	 : Hub75(Width, Height, pixel_storage[0], planes ? plane_storage : nullptr, scan_lists,
+			 panel_type, inverted_stb, Order, Mode, BitDepth, Chains, chain2_data, chain2_clk) {
+		// a second one would draw into the first one's buffers
+		assert(instances == 0);
+		instances++;
+	};
+	~Hub75Panel() { instances--; };
+
+	void set_color(uint x, uint y, Pixel c) {
+		if (x >= Width || y >= Height) return;
+		back_buffer[buffer_offset(Width, Height, x, y)] = c;
+	}
+
+	void set_pixel(uint x, uint y, uint8_t r, uint8_t g, uint8_t b) {
+		set_color(x, y, make_ordered_pixel<Order>(r, g, b));
+	}
+
+	void updateFromRGB565(void *graphics, bool bigEndian) {
+		rgb565_to_buffer((const uint8_t *)graphics, Width, Height, bigEndian);
+	}
+
+	void updateFromRGB888(void *graphics, bool bigEndian) {
+		rgb888_to_buffer((const uint8_t *)graphics, Width, Height, bigEndian);
+	}
+
+	void updateRowFromRGB565(uint y, const uint8_t *src, bool bigEndian) {
+		check_luts();
+		rgb565_row_to_buffer(src, Width, Height, 0, y, Width, bigEndian);
+	}
+
+	void updateRowFromRGB888(uint y, const uint8_t *src, bool bigEndian) {
+		check_luts();
+		rgb888_row_to_buffer(src, Width, Height, 0, y, Width, bigEndian);
+	}
+
+	void updateSpanFromRGB565(uint x, uint y, uint n, const uint8_t *src, bool bigEndian) {
+		if (x >= Width || y >= Height || n > Width - x) return;
+		check_luts();
+		rgb565_row_to_buffer(src, Width, Height, x, y, n, bigEndian);
+	}
+
+	void updateSpanFromRGB888(uint x, uint y, uint n, const uint8_t *src, bool bigEndian) {
+		if (x >= Width || y >= Height || n > Width - x) return;
+		check_luts();
+		rgb888_row_to_buffer(src, Width, Height, x, y, n, bigEndian);
+	}
+
+	void updateSpanFromIndexed(uint x, uint y, uint n, const uint8_t *src, uint bits) {
+		if (x >= Width || y >= Height || n > Width - x) return;
+		check_luts();
+		indexed_row_to_buffer(src, Width, Height, x, y, n, bits);
+	}
+
+	void updateRowFromYCbCr(uint y, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr) {
+		if (y >= Height) return;
+		check_luts();
+		ycbcr_row_to_buffer(luma, cb, cr, Width, Height, y);
+	}
+
+	void present(bool wait = false) {
+		wait_for_swap();
+		if constexpr (planes) {
+			planes_from_pixels(Width, Scan, Chains);
+			build_scan_list(back_list, back_planes);
+		} else {
+			if (skip_empty) {
+				pixels_occupancy(back_buffer, Width, Scan);
+			}
+			build_scan_list(back_list, back_buffer);
+		}
+		present_count++;
+		queue_swap(wait);
+	}
+
+	void dma_complete() {
+		if constexpr (planes) {
+			refresh_complete();
+		} else {
+			pixel_row_complete(Width);
+		}
+	}
 };
@@ -0,0 +1,285 @@
+//
+//  ingest.c
+//
+//  A single producer, single consumer byte ring. Each chunk of a message is stored as a
+//  chunk_t header followed by its data; the first chunk of a message is followed by the topic.
+//  Chunks carry their source, so that the consumer can tell the interleaved messages apart.
+//  Head and tail run freely and are only written by their owner, with memory barriers ordering
+//  the data against the index updates.
+//  Frames (see frame_topic()) are numbered in ring order as their first chunk goes in: both
+//  sides count them the same way, so the consumer can tell from the number of the latest
+//  complete frame whether the one it is at has been superseded.
+//
+
+#include "ingest.h"
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#define RING_MASK (INGEST_RING_SIZE - 1)
+_Static_assert((INGEST_RING_SIZE & RING_MASK) == 0, "INGEST_RING_SIZE must be a power of 2");
+
+enum {
+	CHUNK_FIRST = 1,	// followed by the topic, before the data
+	CHUNK_LAST = 2,
+	CHUNK_ABORT = 4,	// no data, the message before was cut short
+	CHUNK_FRAME = 8,	// with CHUNK_FIRST: the message is a frame
+};
+
+typedef struct {
+	uint16_t len;
+	uint8_t flags;
+	uint8_t topic_len;
+	uint8_t source;
+} chunk_t;
+
+// The current message of a source, on the producer side
+typedef struct {
+	char topic[INGEST_TOPIC_MAX];
+	uint8_t topic_len;
+	bool open;				// begun, but its last part hasn't come yet
+	bool first;
+	bool dropping;			// the rest of the current message is being dropped
+	bool abort_pending;		// the consumer needs to be told about a truncated message
+	bool frame;
+	uint32_t frame_number;
+} producer_t;
+
+// The current message of a source, on the consumer side
+typedef struct {
+	char topic[INGEST_TOPIC_MAX + 1];
+	uint32_t frame_number;	// 0 if it isn't a frame, or done with
+	bool skipping;			// superseded, the rest goes unprocessed
+} consumer_t;
+
+static uint8_t ring[INGEST_RING_SIZE];
+static volatile uint32_t head;	// written by the producer only
+static volatile uint32_t tail;	// written by the consumer only
+
+static producer_t producers[INGEST_SOURCES];
+static uint32_t frames_queued;				// numbered so far
+static volatile uint32_t latest_complete;	// number of the latest frame that is in completely
+
+// consumer state
+static consumer_t consumers[INGEST_SOURCES];
+static uint32_t frames_seen;
+static volatile uint32_t frames_done;		// processed, skipped or aborted, written by the consumer
+static ingest_consumed_fn consumed_callback[INGEST_SOURCES];
+
+static volatile ingest_policy_t policy = INGEST_POLICY;
+static volatile uint32_t queue_frames = INGEST_QUEUE_FRAMES;
+
+static ingest_stats_t stats;
+
+static void ring_write (uint32_t pos, const void *src, uint32_t len) {
+	uint32_t ofs = pos & RING_MASK;
+	uint32_t n = len < INGEST_RING_SIZE - ofs ? len : INGEST_RING_SIZE - ofs;
+	memcpy (&ring[ofs], src, n);
+	memcpy (&ring[0], (const uint8_t *)src + n, len - n);
+}
+
+static void ring_read (uint32_t pos, void *dest, uint32_t len) {
+	uint32_t ofs = pos & RING_MASK;
+	uint32_t n = len < INGEST_RING_SIZE - ofs ? len : INGEST_RING_SIZE - ofs;
+	memcpy (dest, &ring[ofs], n);
+	memcpy ((uint8_t *)dest + n, &ring[0], len - n);
+}
+
+static bool put_chunk (const chunk_t *chunk, const char *topic, const uint8_t *data) {
+	uint32_t h = head;
+	uint32_t used = h - tail;
+	uint32_t size = sizeof(*chunk) + chunk->topic_len + chunk->len;
+	if (size > INGEST_RING_SIZE - used) {
+		return false;
+	}
+	ring_write (h, chunk, sizeof(*chunk));
+	ring_write (h + sizeof(*chunk), topic, chunk->topic_len);
+	ring_write (h + sizeof(*chunk) + chunk->topic_len, data, chunk->len);
+	__dmb();	// data before index
+	head = h + size;
+	if (used + size > stats.max_fill) {
+		stats.max_fill = used + size;
+	}
+	__sev();	// wake a consumer waiting in __wfe()
+	return true;
+}
+
+// Tells the consumer about a message cut short, returns false if there's no room for it yet
+static bool put_abort (producer_t *p, ingest_source_t source) {
+	if (p->abort_pending) {
+		chunk_t chunk = {0, CHUNK_ABORT, 0, (uint8_t)source};
+		p->abort_pending = !put_chunk (&chunk, NULL, NULL);
+	}
+	return !p->abort_pending;
+}
+
+void ingest_begin (ingest_source_t source, const char *t) {
+	producer_t *p = &producers[source];
+	if (p->open && !p->dropping) {
+		// the one before never got its last part
+		p->abort_pending |= !p->first;
+	}
+	p->open = true;
+	p->first = true;
+	p->dropping = false;
+	stats.messages++;
+	size_t len = strlen (t);
+	if (len > INGEST_TOPIC_MAX) {
+		// the transports don't let it through, this is for any that may not check
+		p->dropping = true;
+		stats.dropped_messages++;
+		return;
+	}
+	p->topic_len = (uint8_t)len;
+	memcpy (p->topic, t, len);
+	p->frame = frame_topic (t);
+	if (p->frame && policy == INGEST_QUEUE && frames_queued - frames_done >= queue_frames) {
+		// not a byte of it gets copied
+		p->dropping = true;
+		stats.refused_frames++;
+	}
+}
+
+bool ingest_push (ingest_source_t source, const uint8_t *data, uint16_t len, bool last) {
+	uint32_t start = time_us_32();
+	producer_t *p = &producers[source];
+	stats.callback_count++;
+	stats.bytes += len;
+	bool ready = put_abort (p, source);
+	bool queued = false;
+	if (!p->dropping) {
+		uint8_t flags = (p->first ? CHUNK_FIRST : 0) | (last ? CHUNK_LAST : 0) | (p->first && p->frame ? CHUNK_FRAME : 0);
+		chunk_t chunk = {len, flags, p->first ? p->topic_len : 0, (uint8_t)source};
+		if (ready && put_chunk (&chunk, p->topic, data)) {
+			if (p->first && p->frame) {
+				p->frame_number = ++frames_queued;
+			}
+			if (last && p->frame) {
+				latest_complete = p->frame_number;
+			}
+			p->first = false;
+			queued = true;
+		} else {
+			// The consumer only needs to know if it got part of the message already
+			p->abort_pending |= !p->first;
+			p->dropping = true;
+			stats.dropped_messages++;
+		}
+	}
+	if (last) {
+		p->open = false;
+		p->dropping = false;
+	}
+	uint32_t took = time_us_32() - start;
+	stats.callback_total_us += took;
+	if (took > stats.callback_max_us) {
+		stats.callback_max_us = took;
+	}
+	return queued;
+}
+
+void ingest_abort (ingest_source_t source) {
+	producer_t *p = &producers[source];
+	if (p->open && !p->dropping) {
+		p->abort_pending |= !p->first;
+		stats.dropped_messages++;
+	}
+	p->open = false;
+	p->dropping = false;
+	put_abort (p, source);
+}
+
+uint32_t ingest_room (void) {
+	uint32_t free = INGEST_RING_SIZE - (head - tail);
+	// a pending abort and the topic may come along
+	uint32_t overhead = 2 * sizeof(chunk_t) + INGEST_TOPIC_MAX;
+	return free > overhead ? free - overhead : 0;
+}
+
+void ingest_set_consumed_callback (ingest_source_t source, ingest_consumed_fn callback) {
+	consumed_callback[source] = callback;
+}
+
+void ingest_set_policy (ingest_policy_t p, uint32_t frames) {
+	queue_frames = frames > 0 ? frames : 1;
+	policy = p;
+}
+
+// A frame message is over for the consumer
+static void frame_done (consumer_t *c) {
+	if (c->frame_number) {
+		c->frame_number = 0;
+		frames_done++;
+	}
+	c->skipping = false;
+}
+
+bool ingest_process (void) {
+	uint32_t t = tail;
+	if (t == head) {
+		return false;
+	}
+	__dmb();	// index before data
+	chunk_t chunk;
+	ring_read (t, &chunk, sizeof(chunk));
+	t += sizeof(chunk);
+	ingest_source_t source = (ingest_source_t)chunk.source;
+	consumer_t *c = &consumers[source];
+	char *topic = c->topic;
+	if (chunk.flags & CHUNK_ABORT) {
+		if (!c->skipping) {
+			discard_data (source, topic);
+		}
+		frame_done (c);
+	} else {
+		if (chunk.flags & CHUNK_FIRST) {
+			ring_read (t, topic, chunk.topic_len);
+			topic[chunk.topic_len] = 0;
+			t += chunk.topic_len;
+			c->frame_number = (chunk.flags & CHUNK_FRAME) ? ++frames_seen : 0;
+			c->skipping = false;
+		}
+		bool last = (chunk.flags & CHUNK_LAST) != 0;
+		if (c->frame_number && !c->skipping && policy == INGEST_LATEST && latest_complete > c->frame_number) {
+			// A newer frame is in completely, this one would only hold it up
+			if (!(chunk.flags & CHUNK_FIRST)) {
+				discard_data (source, topic);
+			}
+			c->skipping = true;
+			stats.superseded_frames++;
+		}
+		if (!c->skipping) {
+			// Passed on in place, in two parts if it wraps around the end of the ring
+			uint32_t ofs = t & RING_MASK;
+			uint32_t n = chunk.len < INGEST_RING_SIZE - ofs ? chunk.len : INGEST_RING_SIZE - ofs;
+			if (n < chunk.len) {
+				process_data (source, topic, &ring[ofs], n, false);
+				process_data (source, topic, &ring[0], chunk.len - n, last);
+			} else {
+				process_data (source, topic, &ring[ofs], n, last);
+			}
+		}
+		if (last) {
+			frame_done (c);
+		}
+		t += chunk.len;
+	}
+	__dmb();	// done with the data before handing the space back
+	tail = t;
+	if (consumed_callback[chunk.source] && chunk.len > 0) {
+		consumed_callback[chunk.source] (chunk.len);
+	}
+	return true;
+}
+
+// Only keeps the producer away if it runs on the calling core, else the counters may be
+// off by the odd message
+void ingest_read_stats (ingest_stats_t *s, bool reset) {
+	uint32_t irq = save_and_disable_interrupts();
+	*s = stats;
+	if (reset) {
+		memset (&stats, 0, sizeof(stats));
+	}
+	restore_interrupts (irq);
+}
@@ -0,0 +1,86 @@
+//
+//  ingest.h
+//
+//  Receive ring between the network callbacks (producer) and the frame processing (consumer).
+//  The producer side only copies, so that lwIP isn't held up by the conversion of a frame.
+//  Messages of different sources may be interleaved in the ring, each source has its own
+//  current message (the producer calls still all come from the lwIP context).
+//  Frames coming in faster than they are converted are dropped by the ingest policy, the other
+//  messages (commands, but also delta frames and rectangles) only if the ring is full.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	INGEST_MQTT,
+	INGEST_UDP,
+	INGEST_TCP,
+	INGEST_USB,
+	INGEST_SOURCES
+} ingest_source_t;
+
+// The longest topic of a message (over MQTT the part after the board's prefix). The transports
+// drop messages with a longer one rather than cut it short, which could make it another topic.
+#define INGEST_TOPIC_MAX 20
+
+typedef enum {
+	INGEST_LATEST,		// a frame is skipped, even half converted, once a newer one is in completely
+	INGEST_QUEUE,		// a new frame is dropped before it is copied if N frames are waiting already
+	INGEST_BLOCK,		// frames are only dropped if the ring is full; TCP and USB senders get throttled
+} ingest_policy_t;
+
+typedef struct {
+	uint32_t messages;
+	uint32_t bytes;
+	uint32_t dropped_messages;	// lost entirely or in part because the ring was full, or the topic too long
+	uint32_t superseded_frames;	// skipped by INGEST_LATEST
+	uint32_t refused_frames;	// dropped by INGEST_QUEUE
+	uint32_t max_fill;			// bytes, high water mark
+	uint32_t callback_count;
+	uint32_t callback_max_us;	// time spent in ingest_push()
+	uint64_t callback_total_us;
+} ingest_stats_t;
+
+// Producer (lwIP callback context): a message starts with ingest_begin(), followed by its data
+// in one or more ingest_push() calls, the last one with `last` set, or ingest_abort() if the
+// rest of it won't come. ingest_push() returns false if the data was dropped.
+void ingest_begin (ingest_source_t source, const char *topic);
+bool ingest_push (ingest_source_t source, const uint8_t *data, uint16_t len, bool last);
+void ingest_abort (ingest_source_t source);
+
+// Producer: the most data an ingest_push() would take right now, for a producer that can leave
+// the rest where it is (see usb_frames.c)
+uint32_t ingest_room (void);
+
+// Called on the consumer side after data of `source` went through process_data(), with its
+// length, for a producer that throttles its sender by what was consumed (see tcp_frames.c)
+typedef void (*ingest_consumed_fn) (uint16_t len);
+void ingest_set_consumed_callback (ingest_source_t source, ingest_consumed_fn callback);
+
+// `frames` is N for INGEST_QUEUE; can be changed at any time
+void ingest_set_policy (ingest_policy_t policy, uint32_t frames);
+
+// Consumer: passes the received data on to process_data() (or discard_data() for a message
+// that could not be received completely), returns false if there was nothing to do
+bool ingest_process (void);
+
+void ingest_read_stats (ingest_stats_t *stats, bool reset);
+
+// these need to be implemented outside; the messages of different sources may come interleaved,
+// part by part:
+void process_data (ingest_source_t source, const char *topic, const uint8_t *data, uint16_t len, bool lastPart);
+void discard_data (ingest_source_t source, const char *topic);	// drop what process_data() got of the source's current message
+bool frame_topic (const char *topic);	// a complete frame, that a newer one makes obsolete
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
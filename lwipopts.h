@@ -86,8 +86,8 @@
 #define SLIP_DEBUG                  LWIP_DBG_OFF
 #define DHCP_DEBUG                  LWIP_DBG_OFF
 
-// Needed for MQTT:
-#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL+1) 
+// Needed for MQTT, and the fragment timeout of udp_frames.c:
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL+2) 
 #define MQTT_REQ_MAX_IN_FLIGHT      5
 #define MQTT_DEBUG                  LWIP_DBG_OFF
 
@@ -15,10 +15,18 @@
 
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#include "pico/multicore.h"
 #include "hardware/watchdog.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
 
 #include "mqtt.h"
+#include "ingest.h"
+#include "udp_frames.h"
+#include "tcp_frames.h"
+#include "usb_frames.h"
 #include "hub75.hpp"
+#include "frame_decoder.hpp"
 
 #define use_watchdog 1 // auto-reboots if stuck
 #define WATCHDOG_TIMEOUT_MS  3000 // max is ~4700
@@ -30,9 +38,22 @@ static struct {
 
 static Button buttonA(Interstate75::BUT_A);
 
+#if CHAINS == 2
+#if CHAIN2_DATA_PIN == 0 || CHAIN2_CLK_PIN == 0
+#error "CHAINS 2 needs CHAIN2_DATA_PIN and CHAIN2_CLK_PIN in config.h"
+#endif
+// On an Interstate 75 W, 6 consecutive free GPIOs for the second chain can hardly avoid the RGB
+// LED's (16 to 18), so it stays dark
+static void set_led(uint8_t, uint8_t, uint8_t) {}
+#else
 static RGBLED board_led(Interstate75::LED_R, Interstate75::LED_G, Interstate75::LED_B, ACTIVE_LOW, 80);
 
-static Hub75 panel(WIDTH, HEIGHT, nullptr, PANEL_GENERIC, false);
+static void set_led(uint8_t r, uint8_t g, uint8_t b) {
+	board_led.set_rgb(r, g, b);
+}
+#endif
+
+static Hub75Panel<WIDTH, HEIGHT, BIT_DEPTH, HEIGHT / 2, Hub75::COLOR_ORDER::RGB, Hub75::SCAN_MODE::BIT_PLANES, CHAINS> panel(PANEL_GENERIC, false, CHAIN2_DATA_PIN, CHAIN2_CLK_PIN);
 
 // Interrupt callback required function 
 void __isr dma_complete() {
@@ -97,55 +118,258 @@ static void postError (const char *format, ...) {
 
 static int callCounter = 0;
 
-static char imgBuf[WIDTH*HEIGHT*4];
-static unsigned long bufOfs = 0;
+static FrameDecoder<decltype(panel)> decoder(panel);
+static uint8_t paletteBuf[256 * 3];
+static uint paletteLen = 0;
+
+// The decoder and the palette buffer are shared, they belong to the source whose message they
+// are in the middle of; the same kind of message from another source meanwhile is dropped
+#define NO_SOURCE INGEST_SOURCES
+static ingest_source_t decoderSource = NO_SOURCE;
+static ingest_source_t paletteSource = NO_SOURCE;
+static bool ignoring[INGEST_SOURCES];	// the rest of the source's current message is dropped
+
+// Commands ("c", "b", "d", "m", "t") are carried out once they are in completely: a message can
+// come in several parts, where the ring wraps or the transport split it
+static char cmdBuf[INGEST_SOURCES][64];
+static uint cmdLen[INGEST_SOURCES];		// sizeof(cmdBuf[0]) and more: too long, dropped
+static uint32_t busyDrops = 0;
 
 static Elapsed singleFrame_timer;
 static Elapsed second_timer;
 static int second_frames = 0;
 
+// Times one frame of each conversion path: the per-pixel set_pixel() path the bulk converters
+// replaced, and the table driven ones. The canvas is left with a test pattern.
+static void benchmark_conversion() {
+	uint8_t *frame = (uint8_t *)malloc(WIDTH * HEIGHT * 4);
+	if (!frame) {
+		postError ("bench: no memory for a frame");
+		return;
+	}
+	for (uint i = 0; i < WIDTH * HEIGHT * 4; i++) {
+		frame[i] = i * 7;
+	}
+	panel.begin_update(false);
+	uint32_t t0 = time_us_32();
+	for (uint y = 0; y < HEIGHT; y++) {
+		for (uint x = 0; x < WIDTH; x++) {
+			uint16_t col = (frame[(y * WIDTH + x) * 2] << 8) | frame[(y * WIDTH + x) * 2 + 1];
+			panel.set_pixel(x, y, (col & 0xf800) >> 8, (col & 0x07e0) >> 3, (col & 0x001f) << 3);
+		}
+	}
+	uint32_t t1 = time_us_32();
+	panel.updateFromRGB565(frame, true);
+	uint32_t t2 = time_us_32();
+	panel.updateFromRGB888(frame, true);
+	uint32_t t3 = time_us_32();
+	panel.updateRowFromRGB565(0, frame + 1, true);	// unaligned row
+	uint32_t t4 = time_us_32();
+	const uint8_t *cb = frame + WIDTH * HEIGHT;
+	const uint8_t *cr = cb + WIDTH * HEIGHT / 4;
+	for (uint y = 0; y < HEIGHT; y++) {
+		panel.updateRowFromYCbCr(y, frame + y * WIDTH, cb + y / 2 * WIDTH / 2, cr + y / 2 * WIDTH / 2);
+	}
+	uint32_t t5 = time_us_32();
+	panel.discard_update();
+	free(frame);
+	postMsg("frame conversion: set_pixel %lu us, rgb565 %lu us, rgb888 %lu us, unaligned rgb565 row %lu us, ycbcr 4:2:0 %lu us",
+		t1 - t0, t2 - t1, t3 - t2, t4 - t3, t5 - t4);
+}
+
 extern "C"
-void process_data (const char *topic, const u8_t *data, u16_t len, bool lastPart) {
-	char cmd[64];
-	if (len < sizeof(cmd)) {
-		strncpy (cmd, (const char *)data, len);
-		cmd[len] = 0;
-	} else {
-		cmd[0] = 0;
+void discard_data (ingest_source_t source, const char *topic) {
+	ignoring[source] = false;
+	if (decoderSource == source) {
+		decoder.abort();
+		decoderSource = NO_SOURCE;
+	}
+	if (paletteSource == source) {
+		paletteLen = 0;
+		paletteSource = NO_SOURCE;
+	}
+	cmdLen[source] = 0;
+}
+
+// Drops the rest of a message that can't have the decoder or palette buffer
+static void ignore_message (ingest_source_t source, const char *topic, bool lastPart) {
+	ignoring[source] = !lastPart;
+	busyDrops++;
+}
+
+// Whole frames, that may be dropped for a newer one (see ingest.h); rectangles and the deltas of
+// "f" build on what came before
+extern "C"
+bool frame_topic (const char *topic) {
+	return topic[0] == 'i' && topic[1] != 0;
+}
+
+// Called on core 1 via ingest_process(), with the data of the message in one or more parts
+extern "C"
+void process_data (ingest_source_t source, const char *topic, const uint8_t *data, uint16_t len, bool lastPart) {
+	if (ignoring[source]) {
+		ignoring[source] = !lastPart;
+		return;
+	}
+	const char *cmd = "";
+	if (topic[0] != 0 && topic[1] == 0 && strchr("cbdmt", topic[0])) {
+		char *buf = cmdBuf[source];
+		if (cmdLen[source] + len < sizeof(cmdBuf[0])) {
+			memcpy (buf + cmdLen[source], data, len);
+			cmdLen[source] += len;
+		} else {
+			cmdLen[source] = sizeof(cmdBuf[0]);
+		}
+		if (!lastPart) {
+			return;
+		}
+		if (cmdLen[source] < sizeof(cmdBuf[0])) {
+			buf[cmdLen[source]] = 0;
+			cmd = buf;
+		}
+		cmdLen[source] = 0;
 	}
 	if (strcmp(topic, "c") == 0) {
 		if (strcmp(cmd, "mem") == 0) {
 			postMsg("Free: %lu", getFreeHeap());
+		} else if (strcmp(cmd, "stats") == 0) {	// scan-out counters since the previous "stats"
+			Hub75::ScanStats s = panel.read_stats(true);
+			double secs = s.elapsed_us / 1e6;
+			double mhz = clock_get_hz(clk_sys) / 1e6;
+			postMsg("refresh %.1f/s, isr %lu x %lu/%lu/%lu cycles (min/avg/max), stall data %.1f%% row %.1f%%, missed %lu",
+				s.refreshes / secs,
+				s.isr_count, s.isr_count ? s.isr_min : 0, s.isr_count ? (uint32_t)(s.isr_total / s.isr_count) : 0, s.isr_max,
+				s.stall_data / mhz / s.elapsed_us * 100, s.stall_row / mhz / s.elapsed_us * 100,
+				s.missed);
+		} else if (strcmp(cmd, "bench") == 0) {
+			benchmark_conversion();
+		} else if (strcmp(cmd, "ingest") == 0) {	// receive path counters since the previous "ingest"
+			ingest_stats_t s;
+			ingest_read_stats(&s, true);
+			postMsg("msgs %lu, %lu bytes, dropped %lu, ring max %lu of %u, callbacks %lu, max %lu us, avg %lu us",
+				s.messages, s.bytes, s.dropped_messages, s.max_fill, INGEST_RING_SIZE,
+				s.callback_count, s.callback_max_us, s.callback_count ? (uint32_t)(s.callback_total_us / s.callback_count) : 0);
+			postMsg("frames superseded %lu, refused %lu, dropped for another source's %lu",
+				s.superseded_frames, s.refused_frames, busyDrops);
+			busyDrops = 0;
+			Hub75::RowStats r = panel.read_row_stats(true);
+			postMsg("rows converted %lu, unchanged %lu; plane row pairs converted %lu, unchanged %lu",
+				r.converted, r.skipped, r.plane_rows, r.plane_rows_skipped);
+		} else if (strncmp(cmd, "policy ", 7) == 0) {	// frames coming in too fast: "policy latest", "policy queue N" or "policy block"
+			int n = 0;
+			if (strcmp(cmd + 7, "latest") == 0) {
+				ingest_set_policy(INGEST_LATEST, 0);
+			} else if (sscanf(cmd + 7, "queue %d", &n) == 1 && n > 0) {
+				ingest_set_policy(INGEST_QUEUE, n);
+			} else if (strcmp(cmd + 7, "block") == 0) {
+				ingest_set_policy(INGEST_BLOCK, 0);
+			}
+		} else if (strncmp(cmd, "skip ", 5) == 0) {	// unlit bit plane rows: "skip on" leaves them out of the scan, "skip off"
+			bool on = strcmp(cmd + 5, "on") == 0;
+			if (on || strcmp(cmd + 5, "off") == 0) {
+				panel.set_skip_empty(on);
+			} else {
+				postError ("skip: on or off, not %s", cmd + 5);
+			}
+		} else if (strcmp(cmd, "udp") == 0) {	// UDP frame counters since the previous "udp"
+			frame_fragments_stats_t s;
+			udp_frames_read_stats(&s, true);
+			postMsg("udp packets %lu, frames %lu, dropped %lu, stray fragments %lu",
+				s.packets, s.frames, s.frames_dropped, s.fragments_dropped);
+		} else if (strcmp(cmd, "tcp") == 0) {	// TCP frame stream counters since the previous "tcp"
+			tcp_frames_stats_t s;
+			tcp_frames_read_stats(&s, true);
+			postMsg("tcp connections %lu, msgs %lu, %lu bytes, dropped %lu, skipped %lu",
+				s.connections, s.stream.messages, s.stream.bytes, s.stream.dropped_bytes, s.stream.skipped_bytes);
+		} else if (strcmp(cmd, "usb") == 0) {	// USB frame stream counters since the previous "usb"
+			frame_stream_stats_t s;
+			usb_frames_read_stats(&s, true);
+			postMsg("usb msgs %lu, %lu bytes, dropped %lu, skipped %lu",
+				s.messages, s.bytes, s.dropped_bytes, s.skipped_bytes);
 		}
 	} else if (strcmp(topic, "b") == 0) {	// set brightness
 		int v = 0;
 		sscanf (cmd, "%d", &v);
 		if (v >= 1 && v <= 6) {
-			panel.brightness = v;
+			panel.set_brightness(v);
 		} else {
 			postError ("brightness value outside 1-6: %d", v);
 		}
+	} else if (strcmp(topic, "d") == 0) {	// set colour depth (bit planes), trading it for refresh rate
+		int v = 0;
+		sscanf (cmd, "%d", &v);
+		if (!panel.set_bit_depth(v)) {
+			postError ("bit depth outside 1-%u: %d", panel.max_bit_depth, v);
+		}
+	} else if (strcmp(topic, "m") == 0) {	// split the top bit plane into 1, 2 or 4 slices for a higher flicker frequency
+		int v = 0;
+		sscanf (cmd, "%d", &v);
+		if (!panel.set_bcm_slices(v)) {
+			postError ("BCM slices not a power of 2 up to %u: %d", MAX_BCM_SLICES, v);
+		}
+	} else if (strcmp(topic, "p") == 0) {	// palette for i8/i4, as RGB triplets from entry 0 on
+		if (paletteSource != NO_SOURCE && paletteSource != source) {
+			ignore_message(source, topic, lastPart);
+			return;
+		}
+		paletteSource = lastPart ? NO_SOURCE : source;
+		uint n = std::min((uint)len, (uint)sizeof(paletteBuf) - paletteLen);
+		memcpy (paletteBuf + paletteLen, data, n);
+		paletteLen += n;
+		if (lastPart) {
+			panel.set_palette(0, paletteBuf, paletteLen / 3);
+			paletteLen = 0;
+			decoder.repaint();	// colour cycling
+		}
 	} else if (strcmp(topic, "t") == 0) {	// show text
+		panel.begin_update(true);
 		panel.show_5x7_string (1, 10, (const char*)cmd);
-	} else if (topic[0] == 'i') {	// i16 or i32
-		if ((bufOfs + len) > sizeof(imgBuf)) {
-    		board_led.set_rgb(80,0,50);
-			printf("OVERFLOW\n");
+		panel.present();
+	} else if (topic[0] == 'i' || topic[0] == 'r' || strcmp(topic, "f") == 0) {
+		// i16 or i32, converted row by row as the parts arrive, in (native Pixels), copied, or iq (QOI),
+		// decoded as it arrives. r16 or r32: a rectangle of the image, see FrameDecoder::begin_rect().
+		// f: numbered keyframes and deltas, see FrameDecoder::begin_stream(). i8 or i4: palette indices.
+		// i12: YCbCr 4:2:0, planar.
+		if (!decoder.idle() && decoderSource != source) {
+			ignore_message(source, topic, lastPart);
 			return;
 		}
-		if (bufOfs == 0) {
+		if (decoder.idle()) {
+			decoderSource = source;
+			using Format = FrameDecoder<decltype(panel)>::Format;
 			singleFrame_timer.reset();
+			if (strcmp(topic, "in") == 0) {
+				decoder.begin(Format::NATIVE, false);
+			} else if (strcmp(topic, "iq") == 0) {
+				decoder.begin(Format::QOI, true);
+			} else if (strcmp(topic, "i12") == 0) {
+				decoder.begin(Format::YCBCR420, true);
+			} else if (strcmp(topic, "i8") == 0 || strcmp(topic, "i4") == 0) {
+				decoder.begin(topic[1] == '8' ? Format::INDEXED8 : Format::INDEXED4, true);
+			} else if (topic[0] == 'f') {
+				decoder.begin_stream();
+			} else if (topic[0] == 'r') {
+				decoder.begin_rect(strcmp(topic, "r16") == 0 ? Format::RGB565 : Format::RGB888, true);
+			} else {
+				decoder.begin(strcmp(topic, "i16") == 0 ? Format::RGB565 : Format::RGB888, true);
+			}
 		}
-		memcpy ((char*)imgBuf + bufOfs, data, len);
-		bufOfs += len;
+		decoder.push(data, len);
 		if (lastPart) {
-			second_frames++;
-			bufOfs = 0;
-			if (strcmp(topic, "i16") == 0) {
-				panel.updateFromRGB565 (imgBuf, true);
-			} else {
-				panel.updateFromRGB888 (imgBuf, true);
+			decoderSource = NO_SOURCE;
+			if (!decoder.finish()) {
+				if (decoder.keyframe_needed()) {
+					// not an error, the sender answers with a keyframe
+					if (!mqtt_post ("re/keyframe", "")) {
+						printf("ERROR: mtpp_post failed\n");
+					}
+					return;
+				}
+	    		set_led(80,0,50);
+				printf("BAD FRAME SIZE\n");
+				return;
 			}
+			second_frames++;
 			//printf("took %ld ms\n", singleFrame_timer.elapsed_millis());
 			long millis = second_timer.elapsed_millis();
 			if (millis > 1000) {
@@ -163,8 +387,48 @@ void process_data (const char *topic, const u8_t *data, u16_t len, bool lastPart
 	}
 }
 
+// Core 0 hands status lines to core 1, which does all the drawing once it runs
+static char status_text[32];
+static volatile bool status_pending = false;
+
+static void show_status (const char *format, ...) {
+	while (status_pending) {
+		tight_loop_contents();	// previous one not shown yet
+	}
+	va_list args;
+	va_start(args, format);
+	vsnprintf (status_text, sizeof(status_text), format, args);
+	va_end(args);
+	__dmb();
+	status_pending = true;
+	__sev();
+}
+
+// Core 1: frame decoding and conversion (everything process_data() does), fed by the
+// ingest ring that the lwIP callbacks on core 0 fill, and optionally the scan-out interrupt
+static void core1_main() {
+	multicore_lockout_victim_init();	// for persistent_write()
+	#if DISPLAY_IRQ_CORE == 1
+		// the interrupt gets enabled on the core that calls this
+		panel.start(dma_complete);
+	#endif
+	while (true) {
+		if (status_pending) {
+			panel.begin_update(true);
+			panel.show_5x7_string (1, 1, "%s", status_text);
+			panel.present();
+			__dmb();
+			status_pending = false;
+		}
+		// ingest_push() signals an event, as does every interrupt on this core
+		if (!ingest_process()) {
+			__wfe();
+		}
+	}
+}
+
 static void fatalError() {
-	board_led.set_rgb(100,0,0);
+	set_led(100,0,0);
 	cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
 	while(true);	// leads to a reset thanks to watchdog
 }
@@ -172,9 +436,13 @@ static void fatalError() {
 int main() {
 	stdio_init_all();
 	// Blue
-    board_led.set_rgb(0,0,100);
+    set_led(0,0,100);
 
-	panel.start(dma_complete);
+	panel.set_skip_empty(SKIP_EMPTY_ROWS);
+
+	#if DISPLAY_IRQ_CORE == 0
+		panel.start(dma_complete);
+	#endif
 
 	// draw frame around the entire screen area
 	for (int y = 0; y < HEIGHT; ++y) {
@@ -187,11 +455,19 @@ int main() {
 	}
 
 	panel.show_5x7_string (1, 1, watchdog_enable_caused_reboot() ? "Restart" : "Starting");
+	panel.present();
+
+	// From here on, only core 1 draws
+	multicore_launch_core1(core1_main);
 
 	while (cyw43_arch_init_with_country(WIFI_COUNTRY) != 0) {
 		printf("ERROR: WiFi failed to initialise - will retry\n");
 		busy_wait_ms(1000);
 	}
+	if (USB_FRAMES) {
+		// doesn't wait for the network, for a panel on a cable
+		usb_frames_init();
+	}
 	cyw43_arch_enable_sta_mode();
 	busy_wait_ms(1000);
 	while (cyw43_arch_wifi_connect_timeout_ms(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, WIFI_TIMEOUT_MS) != 0) {
@@ -201,7 +477,7 @@ int main() {
 	printf("Connected to Wifi\n");
 
 	// Yellow
-    board_led.set_rgb(100,100,0);
+    set_led(100,100,0);
 	
 	printf("Memory: total %ld, free %ld\n", getTotalHeap(), getFreeHeap());
 
@@ -234,14 +510,23 @@ int main() {
 	
 	// subscribe to our own ID
 	mqtt_subscribeID (persistent_info.boardID);
-	panel.show_5x7_string (1, 1, "Ready %d ", persistent_info.boardID);
+
+	if (UDP_FRAME_PORT != 0 && !udp_frames_init()) {
+		printf("ERROR: Could not listen on UDP port %d\n", UDP_FRAME_PORT);
+	}
+	if (TCP_FRAME_PORT != 0 && !tcp_frames_init()) {
+		printf("ERROR: Could not listen on TCP port %d\n", TCP_FRAME_PORT);
+	}
+	show_status ("Ready %d ", persistent_info.boardID);
 
 	// Green
-    board_led.set_rgb(0,100,0);
+    set_led(0,100,0);
 	
 	Elapsed blinkTime;
 	bool led_toggle = false;
 	while (1) {
+		// Frames and commands are received into the ingest ring by the lwIP callbacks
+		// and processed on core 1, see core1_main()
 		busy_wait_ms(50);
 		
 		if (blinkTime.elapsed_millis() > BLINK_PERIOD_MS) {
@@ -258,12 +543,12 @@ int main() {
 			if (persistent_info.boardID >= 4) persistent_info.boardID = 0;
 			if (persistent_write (&persistent_info, sizeof(persistent_info))) {
 				if (mqtt_subscribeID (persistent_info.boardID)) {
-					panel.show_5x7_string (1, 1, "New ID %d  ", persistent_info.boardID);
+					show_status ("New ID %d  ", persistent_info.boardID);
 				} else {
-					panel.show_5x7_string (1, 1, "Subsc Err ");
+					show_status ("Subsc Err ");
 				}
 			} else {
-				panel.show_5x7_string (1, 1, "Flash Err ");
+				show_status ("Flash Err ");
 			}
 		}
 
@@ -5,36 +5,252 @@
  */
 
 #include "mqtt.h"
+#include "ingest.h"
 
 #include "string.h"
 #include "pico/cyw43_arch.h"
 #include "pico/time.h"
+#include "lwip/init.h"
+#include "lwip/tcp.h"
+#include "lwip/apps/mqtt_priv.h"
 
+// The receive shim below reaches into mqtt_client_t (mqtt_priv.h, not the MQTT API): conn as a
+// plain tcp_pcb, keep_alive and server_watchdog. Written against lwIP 2.1 and 2.2 (Pico SDK 1.5
+// and 2.x), check those again before letting another version through.
+#if LWIP_VERSION_MAJOR != 2 || LWIP_VERSION_MINOR < 1 || LWIP_VERSION_MINOR > 2
+#error "check the MQTT receive shim against this lwIP's mqtt_priv.h"
+#endif
+#if LWIP_ALTCP
+#error "the MQTT receive shim takes client->conn for a tcp_pcb"
+#endif
 
 static mqtt_client_t *client;
 static ip_addr_t broker_addr;
 static bool subscribedToMQTT = false;
 
-bool mqtt_setup_client() {
-	client = mqtt_client_new();
-	if (client == NULL) {
-		printf("ERROR: Could not allocate MQTT client\n");
+//  Received PUBLISH packets are taken out of the TCP stream before the MQTT app sees them, and
+//  their payload copied from the pbufs into the ingest ring: it doesn't go through the app's
+//  MQTT_VAR_HEADER_BUFFER_LEN buffer first, and the pbufs are freed as soon as the data is
+//  copied. The rest of the stream (acks, ping responses) is passed on to the app unchanged.
+//  Our subscriptions are QoS 0, so there are no PUBACKs to send.
+
+#define RX_TOPIC_MAX 64
+#define RX_FORWARD_SIZE 64
+
+enum {
+	MQTT_TYPE_PUBLISH = 3,
+};
+
+typedef enum {
+	RX_TYPE,
+	RX_LENGTH,
+	RX_TOPIC_LEN,
+	RX_TOPIC,
+	RX_PACKET_ID,
+	RX_PAYLOAD,
+	RX_PASS,			// the rest of a packet for the MQTT app
+} rx_state_t;
+
+static struct {
+	rx_state_t state;
+	bool publish;
+	uint8_t qos;
+	uint8_t length_shift;
+	uint32_t remaining;		// of the current packet
+	uint16_t topic_len;
+	uint16_t got;
+	char topic[RX_TOPIC_MAX];
+	uint8_t forward[RX_FORWARD_SIZE];
+	uint16_t forward_len;
+} rx;
+
+static tcp_recv_fn app_recv;
+
+// The connection is gone, a message in progress won't be completed
+static void rx_lost (void) {
+	if (rx.state == RX_PAYLOAD) {
+		ingest_abort (INGEST_MQTT);
+	}
+	rx.state = RX_TYPE;
+	rx.forward_len = 0;
+}
+
+// Hands what was collected for the MQTT app over. Returns false if the pcb mustn't be touched
+// any more after that (the app closed it, or it was aborted), with what to return in *err.
+static bool rx_forward (void *arg, struct tcp_pcb *pcb, err_t *err) {
+	*err = ERR_OK;
+	if (rx.forward_len == 0) {
+		return true;
+	}
+	struct pbuf *p = pbuf_alloc (PBUF_RAW, rx.forward_len, PBUF_RAM);
+	if (p == NULL) {
+		// The app would lose track of the stream
+		tcp_abort (pcb);
+		*err = ERR_ABRT;
+		rx_lost();
+		return false;
+	}
+	pbuf_take (p, rx.forward, rx.forward_len);
+	rx.forward_len = 0;
+	*err = app_recv (arg, pcb, p, ERR_OK);
+	if (*err == ERR_ABRT || client->conn != pcb) {
+		rx_lost();
 		return false;
 	}
 	return true;
 }
 
-static char topic_id[20];
+// A remaining length of more than 4 bytes, or a PUBLISH whose variable header doesn't fit into
+// its length: there's no telling where the next packet starts, so the connection goes, as any
+// lost one would (see main())
+static err_t rx_malformed (struct tcp_pcb *pcb, struct pbuf *p) {
+	rx_lost();
+	pbuf_free (p);
+	tcp_abort (pcb);
+	return ERR_ABRT;
+}
 
-static void mqtt_incoming_publish_cb( __attribute__((unused)) void *arg, 
-									  const char *topic, 
-									  __attribute__((unused)) u32_t tot_len) {
-	strlcpy (topic_id, strchr(topic, '/') + 1, sizeof(topic_id));
+static void rx_publish_start (void) {
+	rx.topic[rx.topic_len < RX_TOPIC_MAX - 1 ? rx.topic_len : RX_TOPIC_MAX - 1] = 0;
+	const char *slash = strchr(rx.topic, '/');
+	ingest_begin (INGEST_MQTT, slash ? slash + 1 : rx.topic);
+	if (rx.remaining == 0) {
+		ingest_push (INGEST_MQTT, NULL, 0, true);
+		rx.state = RX_TYPE;
+	} else {
+		rx.state = RX_PAYLOAD;
+	}
 }
 
-static void mqtt_incoming_data_cb(__attribute__((unused)) void *arg, const u8_t *data, u16_t len, u8_t flags) {
-	// See MQTT_VAR_HEADER_BUFFER_LEN for defining the mqtt buffer size 
-	process_data (topic_id, data, len, (flags & MQTT_DATA_FLAG_LAST) != 0);
+static err_t mqtt_rx_shim (void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+	if (p == NULL || err != ERR_OK) {
+		rx_lost();
+		return app_recv (arg, pcb, p, err);
+	}
+	err_t app_err;
+	uint16_t forwarded = 0;
+	for (struct pbuf *q = p; q != NULL; q = q->next) {
+		const uint8_t *data = (const uint8_t *)q->payload;
+		uint16_t len = q->len;
+		while (len > 0) {
+			if (rx.state == RX_PAYLOAD) {
+				uint16_t n = len < rx.remaining ? len : (uint16_t)rx.remaining;
+				rx.remaining -= n;
+				ingest_push (INGEST_MQTT, data, n, rx.remaining == 0);
+				if (rx.remaining == 0) {
+					rx.state = RX_TYPE;
+				}
+				data += n;
+				len -= n;
+				continue;
+			}
+			uint8_t c = *data++;
+			len--;
+			if (!rx.publish || rx.state == RX_TYPE) {
+				if (rx.state == RX_TYPE) {
+					rx.publish = (c >> 4) == MQTT_TYPE_PUBLISH;
+					rx.qos = (c >> 1) & 3;
+				}
+				if (!rx.publish) {
+					rx.forward[rx.forward_len++] = c;
+					forwarded++;
+					if (rx.forward_len == RX_FORWARD_SIZE && !rx_forward (arg, pcb, &app_err)) {
+						pbuf_free (p);
+						return app_err;
+					}
+				}
+			}
+			switch (rx.state) {
+				case RX_TYPE:
+					rx.remaining = 0;
+					rx.length_shift = 0;
+					rx.state = RX_LENGTH;
+					break;
+				case RX_LENGTH:
+					rx.remaining |= (uint32_t)(c & 0x7f) << rx.length_shift;
+					rx.length_shift += 7;
+					if ((c & 0x80) && rx.length_shift == 28) {
+						return rx_malformed (pcb, p);	// MQTT allows 4 length bytes
+					}
+					if ((c & 0x80) == 0) {
+						if (!rx.publish) {
+							rx.state = rx.remaining ? RX_PASS : RX_TYPE;
+						} else if (rx.remaining < 2) {
+							return rx_malformed (pcb, p);
+						} else {
+							rx.got = 0;
+							rx.topic_len = 0;
+							rx.state = RX_TOPIC_LEN;
+						}
+					}
+					break;
+				case RX_TOPIC_LEN:
+					rx.topic_len = rx.topic_len << 8 | c;
+					rx.remaining--;
+					if (++rx.got == 2) {
+						if (rx.remaining < rx.topic_len + (rx.qos ? 2u : 0u)) {
+							return rx_malformed (pcb, p);
+						}
+						rx.got = 0;
+						rx.state = rx.topic_len ? RX_TOPIC : (rx.qos ? RX_PACKET_ID : RX_PAYLOAD);
+					}
+					break;
+				case RX_TOPIC:
+					if (rx.got < RX_TOPIC_MAX - 1) {
+						rx.topic[rx.got] = (char)c;
+					}
+					rx.remaining--;
+					if (++rx.got == rx.topic_len) {
+						rx.state = rx.qos ? RX_PACKET_ID : RX_PAYLOAD;
+					}
+					break;
+				case RX_PACKET_ID:
+					rx.remaining--;
+					if (++rx.got == rx.topic_len + 2) {
+						rx.state = RX_PAYLOAD;
+					}
+					break;
+				case RX_PASS:
+					if (--rx.remaining == 0) {
+						rx.state = RX_TYPE;
+					}
+					break;
+				case RX_PAYLOAD:
+					break;
+			}
+			if (rx.state == RX_PAYLOAD) {
+				// done with the variable header
+				rx_publish_start();
+			}
+		}
+	}
+	uint16_t total = p->tot_len;
+	pbuf_free (p);
+	if (!rx_forward (arg, pcb, &app_err)) {
+		return app_err;
+	}
+	// The app acknowledges what it got itself
+	tcp_recved (pcb, total - forwarded);
+	if (client->keep_alive != 0) {
+		client->server_watchdog = 0;
+	}
+	return ERR_OK;
+}
+
+static void mqtt_rx_shim_install (void) {
+	rx_lost();
+	memset (&rx, 0, sizeof(rx));
+	app_recv = client->conn->recv;
+	tcp_recv (client->conn, mqtt_rx_shim);
+}
+
+bool mqtt_setup_client() {
+	client = mqtt_client_new();
+	if (client == NULL) {
+		printf("ERROR: Could not allocate MQTT client\n");
+		return false;
+	}
+	return true;
 }
 
 static void mqtt_sub_request_cb(__attribute__((unused)) void *arg, err_t result) {
@@ -45,7 +261,8 @@ static void mqtt_sub_request_cb(__attribute__((unused)) void *arg, err_t result)
 static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status) {
 	err_t err;
 	if (status == MQTT_CONNECT_ACCEPTED) {
-		mqtt_set_inpub_callback(client, mqtt_incoming_publish_cb, mqtt_incoming_data_cb, NULL);
+		// Incoming messages are queued by the shim, the main loop processes them (see ingest_process)
+		mqtt_rx_shim_install();
 		err = mqtt_subscribe(client, TOPIC_ALL, 0, mqtt_sub_request_cb, NULL);
 		if (err != ERR_OK) {
 			printf("ERROR: mqtt_subscribe return: %d\n", err);
@@ -21,9 +21,6 @@ bool mqtt_ready();
 bool mqtt_post(const char *topic, const char *msg);
 bool mqtt_subscribeID (int id);
 
-// this needs to be implemented outside:
-void process_data (const char *topic, const u8_t *data, u16_t len, bool finalPart);
-
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -11,6 +11,7 @@
 
 #include <hardware/flash.h>
 #include <hardware/sync.h>
+#include <pico/multicore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
@@ -70,10 +71,10 @@ bool persistent_write (void *data, size_t len) {
 	
 	for (int i = 0; i < 1; ++i) {
 		uint32_t ints = save_and_disable_interrupts();
-		//multicore_lockout_start_blocking();	// if we use multicore, the other core must call multicore_lockout_victim_init() once at start!
+		multicore_lockout_start_blocking();	// the other core must have called multicore_lockout_victim_init() at start!
 		flash_range_erase (page_offset, FLASH_SECTOR_SIZE);
 		flash_range_program (page_offset, buffer, FLASH_PAGE_SIZE);
-		//multicore_lockout_end_blocking();
+		multicore_lockout_end_blocking();
 		restore_interrupts (ints);
 		if (memcmp (buffer, (char *)XIP_BASE + page_offset, sizeof(buffer)) == 0) {
 			return true;
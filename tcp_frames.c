@@ -0,0 +1,155 @@
+//
+//  tcp_frames.c
+//
+//  The payload is copied into the ingest ring as it arrives and the pbufs freed right away,
+//  but only acknowledged with tcp_recved() once the consumer went through it: the data in
+//  flight and in the ring is bounded by the receive window (TCP_WND). That happens per chunk,
+//  not per frame, as a frame may well be larger than the window.
+//  The consumer runs on the other core, it hands the acknowledgement back to the lwIP context
+//  through an async_context worker.
+//
+
+#include "tcp_frames.h"
+#include "ingest.h"
+
+#include <string.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/tcp.h"
+
+static struct tcp_pcb *listener;
+static struct tcp_pcb *client;
+static frame_stream_t stream;
+
+static volatile uint32_t consumed;	// payload bytes, written by the consumer only
+static uint32_t consumed_seen;		// lwIP context from here on
+static uint32_t unacknowledged;		// payload of the current connection in the ring
+static uint32_t stale;				// payload of dropped connections still in the ring, ahead of it
+
+static tcp_frames_stats_t stats;
+
+static void acknowledge (async_context_t *context, async_when_pending_worker_t *worker);
+
+static async_when_pending_worker_t ack_worker = {.do_work = acknowledge};
+
+// consumer side
+static void tcp_consumed (uint16_t len) {
+	consumed += len;
+	async_context_set_work_pending (cyw43_arch_async_context(), &ack_worker);
+}
+
+static void recved (uint32_t len) {
+	while (len > 0) {
+		uint16_t n = len > 0xffff ? 0xffff : (uint16_t)len;
+		tcp_recved (client, n);
+		len -= n;
+	}
+}
+
+static void acknowledge (__attribute__((unused)) async_context_t *context,
+						 __attribute__((unused)) async_when_pending_worker_t *worker) {
+	uint32_t c = consumed;
+	uint32_t n = c - consumed_seen;
+	consumed_seen = c;
+	// The ring gives back the bytes of dropped connections first, they aren't this one's
+	uint32_t s = n < stale ? n : stale;
+	stale -= s;
+	n -= s;
+	if (n > unacknowledged) {
+		n = unacknowledged;
+	}
+	unacknowledged -= n;
+	if (client != NULL) {
+		recved (n);
+	}
+}
+
+static void drop_client (void) {
+	frame_stream_reset (&stream);
+	client = NULL;
+	stale += unacknowledged;
+	unacknowledged = 0;
+}
+
+static void tcp_frames_err (__attribute__((unused)) void *arg, __attribute__((unused)) err_t err) {
+	// the pcb is gone already
+	drop_client();
+}
+
+static err_t tcp_frames_recv (__attribute__((unused)) void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+	if (p == NULL) {
+		// closed by the sender
+		drop_client();
+		tcp_arg (tpcb, NULL);
+		tcp_recv (tpcb, NULL);
+		tcp_err (tpcb, NULL);
+		if (tcp_close (tpcb) != ERR_OK) {
+			tcp_abort (tpcb);
+			return ERR_ABRT;
+		}
+		return ERR_OK;
+	}
+	if (err != ERR_OK) {
+		pbuf_free (p);
+		return err;
+	}
+	uint32_t queued = 0;
+	for (struct pbuf *q = p; q != NULL; q = q->next) {
+		queued += frame_stream_feed (&stream, (const uint8_t *)q->payload, q->len);
+	}
+	unacknowledged += queued;
+	// headers and dropped data are done with
+	recved (p->tot_len - queued);
+	pbuf_free (p);
+	return ERR_OK;
+}
+
+static err_t tcp_frames_accept (__attribute__((unused)) void *arg, struct tcp_pcb *newpcb, err_t err) {
+	if (err != ERR_OK || newpcb == NULL) {
+		return ERR_VAL;
+	}
+	if (client != NULL) {
+		// the sender most likely reconnected, before the old connection timed out
+		struct tcp_pcb *old = client;
+		drop_client();
+		tcp_err (old, NULL);
+		tcp_abort (old);
+	}
+	client = newpcb;
+	stats.connections++;
+	tcp_setprio (newpcb, TCP_PRIO_MAX);
+	tcp_recv (newpcb, tcp_frames_recv);
+	tcp_err (newpcb, tcp_frames_err);
+	return ERR_OK;
+}
+
+bool tcp_frames_init (void) {
+	frame_stream_init (&stream, INGEST_TCP);
+	ingest_set_consumed_callback (INGEST_TCP, tcp_consumed);
+
+	cyw43_arch_lwip_begin();
+	async_context_add_when_pending_worker (cyw43_arch_async_context(), &ack_worker);
+	struct tcp_pcb *pcb = tcp_new_ip_type (IPADDR_TYPE_ANY);
+	bool ok = pcb != NULL && tcp_bind (pcb, IP_ANY_TYPE, TCP_FRAME_PORT) == ERR_OK;
+	if (ok) {
+		listener = tcp_listen_with_backlog (pcb, 1);
+		ok = listener != NULL;
+	}
+	if (ok) {
+		tcp_accept (listener, tcp_frames_accept);
+	} else if (pcb != NULL) {
+		tcp_close (pcb);
+	}
+	cyw43_arch_lwip_end();
+	return ok;
+}
+
+void tcp_frames_read_stats (tcp_frames_stats_t *s, bool reset) {
+	cyw43_arch_lwip_begin();
+	s->connections = stats.connections;
+	s->stream = stream.stats;
+	if (reset) {
+		memset (&stats, 0, sizeof(stats));
+		memset (&stream.stats, 0, sizeof(stream.stats));
+	}
+	cyw43_arch_lwip_end();
+}
@@ -0,0 +1,35 @@
+//
+//  tcp_frames.h
+//
+//  A persistent TCP connection straight from the sender, carrying messages as described in
+//  frame_stream.h (MQTT stays for control). The receive window is only opened again as the
+//  frame processing consumes the data, so a fast sender is throttled rather than dropped.
+//  One connection at a time, a new one replaces it. The decoder is shared: a frame that comes
+//  in while one from another transport is being decoded is dropped (see process_data()).
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "frame_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	uint32_t connections;
+	frame_stream_stats_t stream;
+} tcp_frames_stats_t;
+
+// Starts listening on TCP_FRAME_PORT
+bool tcp_frames_init (void);
+
+void tcp_frames_read_stats (tcp_frames_stats_t *stats, bool reset);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
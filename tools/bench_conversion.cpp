@@ -0,0 +1,92 @@
+//
+//  bench_conversion.cpp
+//
+//  Times the panel's conversion paths on the host, like "c bench" does on the device: the
+//  per-pixel set_pixel() path the bulk converters replaced (before), the table driven
+//  RGB565/RGB888 kernels (after), and planar YCbCr 4:2:0. Each path is also given as a factor
+//  of the per-pixel one. Host numbers only compare the paths with each other, the device is
+//  what counts.
+//
+//  Build (from the repo root):
+//    c++ -std=c++17 -O2 -Itools/host -I. tools/bench_conversion.cpp hub75.cpp -o bench_conversion
+//
+//    bench_conversion [ITERATIONS]
+//        converts a WIDTH x HEIGHT (config.h) frame ITERATIONS times per path, 200 if not given
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "config.h"
+#include "hub75.hpp"
+
+static Hub75Panel<WIDTH, HEIGHT> panel;
+
+static uint64_t now_ns() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t baseline_ns = 0;	// best time of the first path, the others are compared with it
+
+// Runs `convert` `iterations` times and prints the best and average time of one frame
+template <typename F>
+static void bench(const char *name, uint iterations, F convert) {
+	uint64_t best = ~0ull, total = 0;
+	for (uint i = 0; i < iterations; i++) {
+		uint64_t t = now_ns();
+		convert();
+		t = now_ns() - t;
+		best = std::min(best, t);
+		total += t;
+	}
+	if (baseline_ns == 0) {
+		baseline_ns = best;
+	}
+	printf("%-22s %8.1f us best, %8.1f us average, %5.2fx the time of set_pixel\n", name, best / 1e3, total / 1e3 / iterations,
+		(double)best / baseline_ns);
+}
+
+int main(int argc, char **argv) {
+	uint iterations = argc > 1 ? atoi(argv[1]) : 200;
+	if (iterations == 0) {
+		fprintf(stderr, "usage: %s [ITERATIONS]\n", argv[0]);
+		return 2;
+	}
+	// the same content as "c bench", one byte more for the unaligned rows
+	std::vector<uint8_t> frame(WIDTH * HEIGHT * 4 + 1);
+	for (uint i = 0; i < frame.size(); i++) {
+		frame[i] = i * 7;
+	}
+	const uint8_t *cb = frame.data() + WIDTH * HEIGHT;
+	const uint8_t *cr = cb + WIDTH * HEIGHT / 4;
+
+	printf("%ux%u, %u iterations\n", WIDTH, HEIGHT, iterations);
+	panel.begin_update(false);
+	bench("set_pixel rgb565", iterations, [&]() {
+		for (uint y = 0; y < HEIGHT; y++) {
+			for (uint x = 0; x < WIDTH; x++) {
+				uint16_t col = (frame[(y * WIDTH + x) * 2] << 8) | frame[(y * WIDTH + x) * 2 + 1];
+				panel.set_pixel(x, y, (col & 0xf800) >> 8, (col & 0x07e0) >> 3, (col & 0x001f) << 3);
+			}
+		}
+	});
+	bench("rgb565 big endian", iterations, [&]() { panel.updateFromRGB565(frame.data(), true); });
+	bench("rgb565 little endian", iterations, [&]() { panel.updateFromRGB565(frame.data(), false); });
+	bench("rgb565 unaligned rows", iterations, [&]() {
+		for (uint y = 0; y < HEIGHT; y++) {
+			panel.updateRowFromRGB565(y, frame.data() + 1 + y * WIDTH * 2, true);
+		}
+	});
+	bench("rgb888", iterations, [&]() { panel.updateFromRGB888(frame.data(), true); });
+	bench("ycbcr 4:2:0", iterations, [&]() {
+		for (uint y = 0; y < HEIGHT; y++) {
+			panel.updateRowFromYCbCr(y, frame.data() + y * WIDTH, cb + y / 2 * WIDTH / 2, cr + y / 2 * WIDTH / 2);
+		}
+	});
+	panel.discard_update();
+	return 0;
+}
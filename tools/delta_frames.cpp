@@ -0,0 +1,189 @@
+//
+//  delta_frames.cpp
+//
+//  Host side of the "f" topic: encodes raw RGB frames as numbered keyframes and deltas (see
+//  FrameDecoder::begin_stream()), and round-trips them through the panel's FrameDecoder.
+//
+//  Build (from the repo root):
+//    c++ -std=c++17 -O2 -Itools/host -I. tools/delta_frames.cpp -o delta_frames
+//
+//  Frames are raw 24 bit RGB, one after the other (see qoi_frames.cpp).
+//
+//    delta_frames encode 128 64 16 frames.rgb out/frame [KEYFRAME_INTERVAL]
+//        writes out/frame0000.bin etc., the payloads to publish in order
+//    delta_frames test 128 64 16 [frames.rgb]
+//        round trip, with a lost delta on the way; an animated test pattern if no file
+//
+//  A sender keeps one DeltaEncoder per panel, and calls it with force_keyframe after the panel
+//  posted on re/keyframe.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "host/frame_tool.hpp"
+
+class DeltaEncoder {
+	public:
+	DeltaEncoder(uint width, uint height, uint bits, uint keyframe_interval)
+	 : width(width), height(height), bpp(bits / 8), keyframe_interval(keyframe_interval),
+	   prev(width * height), cur(width * height) {};
+
+	std::vector<uint8_t> encode(const uint8_t *rgb, bool force_keyframe) {
+		uint size = width * height;
+		for (uint i = 0; i < size; i++, rgb += 3) {
+			cur[i] = bpp == 2 ? (rgb[0] & 0xf8) << 8 | (rgb[1] & 0xfc) << 3 | rgb[2] >> 3
+							  : rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+		}
+		std::vector<uint8_t> out = {'D', (uint8_t)(bpp * 8), (uint8_t)(seq >> 8), (uint8_t)seq};
+		bool key = force_keyframe || frames_since_key + 1 >= keyframe_interval || seq == 0;
+		if (!key) {
+			// A gap shorter than a run header is cheaper sent along
+			uint max_gap = (4 + bpp - 1) / bpp;
+			uint done = 0;	// pixels covered by the runs so far
+			for (uint i = 0; i < size; ) {
+				if (cur[i] == prev[i]) {
+					i++;
+					continue;
+				}
+				uint last = i;	// last changed pixel of the run
+				for (uint j = i + 1; j < size && j - last <= max_gap; j++) {
+					if (cur[j] != prev[j]) {
+						last = j;
+					}
+				}
+				uint end = last + 1;
+				uint skip = i - done;
+				while (skip > 0xffff) {
+					put_run(out, 0xffff, 0);
+					skip -= 0xffff;
+				}
+				for (uint start = i; start < end; ) {
+					uint count = std::min(end - start, 0xffffu);
+					put_run(out, start == i ? skip : 0, count);
+					for (uint p = start; p < start + count; p++) {
+						put_pixel(out, cur[p]);
+					}
+					start += count;
+				}
+				done = end;
+				i = end;
+			}
+			key = out.size() >= 4 + size * bpp;
+		}
+		if (key) {
+			out.resize(4);
+			out[0] = 'K';
+			for (uint i = 0; i < size; i++) {
+				put_pixel(out, cur[i]);
+			}
+			frames_since_key = 0;
+		} else {
+			frames_since_key++;
+		}
+		prev.swap(cur);
+		seq = (seq + 1) & 0xffff;
+		return out;
+	}
+
+	private:
+	void put_run(std::vector<uint8_t> &out, uint skip, uint count) {
+		out.insert(out.end(), {(uint8_t)(skip >> 8), (uint8_t)skip, (uint8_t)(count >> 8), (uint8_t)count});
+	}
+
+	void put_pixel(std::vector<uint8_t> &out, uint32_t v) {
+		for (int b = bpp - 1; b >= 0; b--) {
+			out.push_back(v >> (b * 8));
+		}
+	}
+
+	uint width, height, bpp, keyframe_interval;
+	std::vector<uint32_t> prev, cur;
+	uint seq = 0;
+	uint frames_since_key = 0;
+};
+
+// A still background with a moving block and a changing "counter"
+static RGBFrames test_animation(uint w, uint h) {
+	RGBFrames frames;
+	for (uint n = 0; n < 40; n++) {
+		std::vector<uint8_t> f(w * h * 3);
+		for (uint y = 0; y < h; y++) for (uint x = 0; x < w; x++) {
+			uint8_t *p = &f[(y * w + x) * 3];
+			p[0] = x * 255 / w; p[1] = y * 255 / h; p[2] = 64;
+			if (x >= n % w && x < n % w + 6 && y >= h / 2 && y < h / 2 + 6) { p[0] = p[1] = p[2] = 255; }
+			if (y < 7 && x < 20 && ((x * 7 + y * 3 + n) % 5) == 0) { p[0] = 255; p[1] = 0; }
+		}
+		frames.push_back(f);
+	}
+	return frames;
+}
+
+// What the panel should show for a frame at this pixel format
+static std::vector<uint8_t> quantized(const std::vector<uint8_t> &rgb, uint bits) {
+	std::vector<uint8_t> q(rgb);
+	if (bits == 16) {
+		for (uint i = 0; i < q.size(); i += 3) {
+			q[i] &= 0xf8;
+			q[i + 1] &= 0xfc;
+			q[i + 2] &= 0xf8;
+		}
+	}
+	return q;
+}
+
+int main(int argc, char **argv) {
+	FrameTool tool;
+	if (int err = tool.parse(argc, argv, 1, "encode|test WIDTH HEIGHT 16|32 [frames.rgb [out_prefix [KEYFRAME_INTERVAL]]]", test_animation)) {
+		return err;
+	}
+	bool encode = tool.encode;
+	uint w = tool.width, h = tool.height, bits = atoi(argv[4]);
+	if (bits != 16 && bits != 32) {
+		fprintf(stderr, "bits per pixel must be 16 or 32\n");
+		return 2;
+	}
+	const RGBFrames &frames = tool.frames;
+
+	DeltaEncoder encoder(w, h, bits, argc > 7 ? atoi(argv[7]) : 50);
+	FakePanel panel(w, h);
+	FrameDecoder<FakePanel> decoder(panel);
+	size_t total = 0;
+	uint failed = 0, keyframes = 0;
+	bool force_keyframe = false;
+	uint lose = frames.size() / 2;	// test: this frame never arrives
+	for (uint n = 0; n < frames.size(); n++) {
+		std::vector<uint8_t> msg = encoder.encode(frames[n].data(), force_keyframe);
+		force_keyframe = false;
+		total += msg.size();
+		keyframes += msg[0] == 'K';
+		if (encode) {
+			if (!tool.write(n, "bin", msg)) {
+				return 1;
+			}
+			continue;
+		}
+		if (n == lose && msg[0] == 'D') {
+			continue;
+		}
+		decoder.begin_stream();
+		bool shown = push_in_chunks(decoder, msg);
+		bool ok;
+		if (!shown && decoder.keyframe_needed()) {
+			force_keyframe = true;
+			ok = n == lose + 1;		// only right after the lost one
+		} else {
+			ok = shown && panel.shown == quantized(frames[n], bits);
+		}
+		failed += !ok;
+		printf("frame %u: %c %zu bytes, %.1f%% of i%u%s%s\n", n, msg[0], msg.size(), 100.0 * msg.size() / (w * h * bits / 8), bits,
+			shown ? "" : ", keyframe requested", round_trip_result(ok));
+	}
+	if (frames.size()) {
+		printf("%zu frames (%u keyframes), average %zu bytes, %.1f%% of i%u\n", frames.size(), keyframes,
+			total / frames.size(), 100.0 * total / frames.size() / (w * h * bits / 8), bits);
+	}
+	return failed ? 1 : 0;
+}
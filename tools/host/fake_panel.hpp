@@ -0,0 +1,90 @@
+// Stands in for Hub75 with an RGB canvas, for what FrameDecoder needs of it in the host tools.
+// Rows are hashed with Hub75::hash_row(), so the same rows are skipped as on the panel.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "pico/types.h"
+#include "hub75.hpp"
+
+struct FakePanel {
+	uint width, height;
+	std::vector<uint8_t> canvas;	// RGB
+	std::vector<uint8_t> shown;
+	uint32_t present_count = 0;
+
+	// Like Hub75's, for the one canvas. `drawn` counts the spans and rows actually converted.
+	std::vector<uint32_t> row_hash;
+	std::vector<bool> row_hashed;
+	Hub75::RowStats row_stats = {};
+	uint32_t drawn = 0;
+
+	FakePanel(uint width, uint height) : width(width), height(height), canvas(width * height * 3), shown(canvas),
+		row_hash(height), row_hashed(height) {};
+
+	void begin_update(bool) { forget_rows(); };
+	void begin_row_update(bool) {};
+	bool row_unchanged(uint y, uint32_t hash) {
+		if (row_hashed[y] && row_hash[y] == hash) {
+			row_stats.skipped++;
+			return true;
+		}
+		row_hash[y] = hash;
+		row_hashed[y] = true;
+		row_stats.converted++;
+		return false;
+	};
+	void row_changed(uint y) { row_hashed[y] = false; };
+	void forget_rows() { std::fill(row_hashed.begin(), row_hashed.end(), false); };
+	static uint32_t hash_row(const uint8_t *p, uint len, uint32_t seed) { return Hub75::hash_row(p, len, seed); };
+	void discard_update() {};
+	void present() { shown = canvas; present_count++; };
+	bool updateFromNative(uint, const uint8_t *, uint) { return false; };
+
+	void updateSpanFromRGB888(uint x, uint y, uint n, const uint8_t *src, bool bigEndian) {
+		drawn++;
+		uint8_t *d = &canvas[(y * width + x) * 3];
+		for (uint i = 0; i < n; i++, src += 4, d += 3) {
+			d[0] = src[bigEndian ? 1 : 2];
+			d[1] = src[bigEndian ? 2 : 1];
+			d[2] = src[bigEndian ? 3 : 0];
+		}
+	}
+	void updateRowFromRGB888(uint y, const uint8_t *src, bool bigEndian) { updateSpanFromRGB888(0, y, width, src, bigEndian); };
+
+	void updateSpanFromRGB565(uint x, uint y, uint n, const uint8_t *src, bool bigEndian) {
+		drawn++;
+		uint8_t *d = &canvas[(y * width + x) * 3];
+		for (uint i = 0; i < n; i++, src += 2, d += 3) {
+			uint col = bigEndian ? src[0] << 8 | src[1] : src[1] << 8 | src[0];
+			d[0] = (col >> 8) & 0xf8;
+			d[1] = (col >> 3) & 0xfc;
+			d[2] = (col << 3) & 0xf8;
+		}
+	}
+	void updateRowFromRGB565(uint y, const uint8_t *src, bool bigEndian) { updateSpanFromRGB565(0, y, width, src, bigEndian); };
+
+	void updateRowFromYCbCr(uint y, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr) {
+		drawn++;
+		uint8_t *d = &canvas[y * width * 3];
+		for (uint x = 0; x < width; x++, d += 3) {
+			int c = 298 * (luma[x] - 16), e = cb[x / 2] - 128, f = cr[x / 2] - 128;
+			d[0] = std::clamp((c + 409 * f + 128) >> 8, 0, 255);
+			d[1] = std::clamp((c - 100 * e - 208 * f + 128) >> 8, 0, 255);
+			d[2] = std::clamp((c + 516 * e + 128) >> 8, 0, 255);
+		}
+	}
+
+	// The tools here send no indexed frames, test_formats runs them through Hub75's own palette
+	uint8_t palette[256][3] = {};
+	void updateSpanFromIndexed(uint x, uint y, uint n, const uint8_t *src, uint bits) {
+		drawn++;
+		uint8_t *d = &canvas[(y * width + x) * 3];
+		for (uint i = 0; i < n; i++, d += 3) {
+			uint index = bits == 8 ? src[i] : (src[i / 2] >> (i & 1 ? 0 : 4)) & 0x0f;
+			memcpy (d, palette[index], 3);
+		}
+	}
+};
@@ -0,0 +1,88 @@
+// What the encoder tools (qoi_frames, delta_frames) have in common: the command line, reading
+// raw RGB frames and writing out the encoded ones, and pushing a message through FrameDecoder
+// (also for test_formats).
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "pico/types.h"
+#include "frame_decoder.hpp"
+#include "fake_panel.hpp"
+
+typedef std::vector<std::vector<uint8_t>> RGBFrames;
+
+struct FrameTool {
+	bool encode = false;
+	uint width = 0, height = 0;
+	RGBFrames frames;			// raw 24 bit RGB
+	const char *out_prefix = nullptr;
+
+	// The command line is "encode|test WIDTH HEIGHT", `extra` arguments of the tool's own, then
+	// [frames.rgb [out_prefix]], as given in `usage`. Without a file, test uses `test_frames`.
+	// Returns the exit code for a bad command line, 0 if all is well.
+	int parse(int argc, char **argv, int extra, const char *usage, RGBFrames (*test_frames)(uint w, uint h)) {
+		if (argc < 4 + extra) {
+			fprintf(stderr, "usage: %s %s\n", argv[0], usage);
+			return 2;
+		}
+		encode = strcmp(argv[1], "encode") == 0;
+		width = atoi(argv[2]);
+		height = atoi(argv[3]);
+		int file = 4 + extra;
+		if (argc > file) {
+			FILE *f = fopen(argv[file], "rb");
+			if (!f) {
+				perror(argv[file]);
+				return 2;
+			}
+			uint frame_size = width * height * 3;
+			std::vector<uint8_t> frame(frame_size);
+			while (fread(frame.data(), 1, frame_size, f) == frame_size) {
+				frames.push_back(frame);
+			}
+			fclose(f);
+		} else if (!encode) {
+			frames = test_frames(width, height);
+		}
+		if (encode && argc <= file + 1) {
+			fprintf(stderr, "encode needs frames.rgb and out_prefix\n");
+			return 2;
+		}
+		out_prefix = encode ? argv[file + 1] : nullptr;
+		return 0;
+	}
+
+	// Writes encoded frame n to out_prefix, numbered, e.g. out/frame0000.qoi
+	bool write(uint n, const char *extension, const std::vector<uint8_t> &data) {
+		char name[1024];
+		snprintf(name, sizeof(name), "%s%04u.%s", out_prefix, n, extension);
+		FILE *f = fopen(name, "wb");
+		bool ok = f && fwrite(data.data(), 1, data.size(), f) == data.size();
+		if (!ok) {
+			perror(name);
+		}
+		if (f) {
+			fclose(f);
+		}
+		return ok;
+	}
+};
+
+// Pushes a message into a decoder that has begun, in chunks of random size, as MQTT may deliver
+// them, and returns what finish() does
+template <class Panel>
+static inline bool push_in_chunks(FrameDecoder<Panel> &decoder, const std::vector<uint8_t> &msg) {
+	for (size_t ofs = 0; ofs < msg.size(); ) {
+		size_t len = std::min(msg.size() - ofs, (size_t)(1 + rand() % 700));
+		decoder.push(msg.data() + ofs, len);
+		ofs += len;
+	}
+	return decoder.finish();
+}
+
+// For the end of a line about a frame
+static inline const char *round_trip_result(bool ok) {
+	return ok ? "" : "  ROUND TRIP FAILED";
+}
@@ -0,0 +1,43 @@
+// See pico/stdlib.h
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct {
+	uint32_t ctrl;
+} dma_channel_config;
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+typedef struct {
+	volatile uint32_t read_addr, write_addr, transfer_count, ctrl_trig;
+	volatile uint32_t al1_ctrl, al1_read_addr, al1_write_addr, al1_transfer_count_trig;
+	volatile uint32_t al2_ctrl, al2_transfer_count, al2_read_addr, al2_write_addr_trig;
+	volatile uint32_t al3_ctrl, al3_write_addr, al3_transfer_count, al3_read_addr_trig;
+} dma_channel_hw_t;
+typedef struct {
+	dma_channel_hw_t ch[12];
+} dma_hw_t;
+static dma_hw_t dma_host;
+static dma_hw_t *const dma_hw = &dma_host;
+
+static inline int dma_claim_unused_channel(bool) { return 0; }
+static inline void dma_channel_unclaim(uint) {}
+static inline bool dma_channel_is_claimed(uint) { return false; }
+static inline dma_channel_config dma_channel_get_default_config(uint) { return {}; }
+static inline dma_channel_config dma_get_channel_config(uint) { return {}; }
+static inline void dma_channel_set_config(uint, const dma_channel_config *, bool) {}
+static inline void channel_config_set_transfer_data_size(dma_channel_config *, dma_channel_transfer_size) {}
+static inline void channel_config_set_bswap(dma_channel_config *, bool) {}
+static inline void channel_config_set_dreq(dma_channel_config *, uint) {}
+static inline void channel_config_set_write_increment(dma_channel_config *, bool) {}
+static inline void channel_config_set_chain_to(dma_channel_config *, uint) {}
+static inline void channel_config_set_ring(dma_channel_config *, bool, uint) {}
+static inline void channel_config_set_irq_quiet(dma_channel_config *, bool) {}
+static inline void dma_channel_configure(uint, const dma_channel_config *, volatile void *, const volatile void *, uint, bool) {}
+static inline void dma_channel_set_irq0_enabled(uint, bool) {}
+static inline bool dma_channel_get_irq0_status(uint) { return false; }
+static inline void dma_channel_acknowledge_irq0(uint) {}
+static inline void dma_channel_abort(uint) {}
+static inline void dma_channel_set_trans_count(uint, uint32_t, bool) {}
+static inline void dma_channel_set_read_addr(uint, const volatile void *, bool) {}
+static inline void dma_channel_transfer_from_buffer_now(uint, const volatile void *, uint32_t) {}
+static inline void dma_channel_wait_for_finish_blocking(uint) {}
@@ -0,0 +1,12 @@
+// See pico/stdlib.h
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef void (*irq_handler_t)();
+enum { DMA_IRQ_0 = 11 };
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+static inline void irq_add_shared_handler(uint, irq_handler_t, uint8_t) {}
+static inline void irq_remove_handler(uint, irq_handler_t) {}
+static inline void irq_set_enabled(uint, bool) {}
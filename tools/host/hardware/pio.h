@@ -0,0 +1,34 @@
+// See pico/stdlib.h
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct {
+	volatile uint32_t ctrl, fstat, fdebug, flevel, txf[4], rxf[4], irq;
+	volatile uint32_t instr_mem[32];
+} pio_hw_t;
+typedef pio_hw_t *PIO;
+static pio_hw_t pio0_host;
+static pio_hw_t *const pio0 = &pio0_host;
+typedef struct {
+	uint32_t clkdiv, execctrl, shiftctrl, pinctrl;
+} pio_sm_config;
+typedef struct {
+	const uint16_t *instructions;
+	uint8_t length;
+	int8_t origin;
+} pio_program_t;
+#define PIO_FDEBUG_TXSTALL_LSB 24
+#define PIO_FDEBUG_TXOVER_LSB 16
+
+static inline void pio_sm_claim(PIO, uint) {}
+static inline void pio_sm_unclaim(PIO, uint) {}
+static inline bool pio_sm_is_claimed(PIO, uint) { return false; }
+static inline uint pio_add_program(PIO, const pio_program_t *) { return 0; }
+static inline void pio_remove_program(PIO, const pio_program_t *, uint) {}
+static inline void pio_sm_set_clkdiv(PIO, uint, float) {}
+static inline void pio_sm_set_enabled(PIO, uint, bool) {}
+static inline void pio_sm_drain_tx_fifo(PIO, uint) {}
+static inline void pio_sm_put_blocking(PIO, uint, uint32_t) {}
+static inline bool pio_sm_is_tx_fifo_empty(PIO, uint) { return true; }
+static inline uint pio_get_dreq(PIO, uint, bool) { return 0; }
@@ -0,0 +1,10 @@
+// See pico/stdlib.h
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct {
+	volatile uint32_t csr, rvr, cvr, calib;
+} systick_hw_t;
+static systick_hw_t systick_host;
+static systick_hw_t *const systick_hw = &systick_host;
@@ -0,0 +1,21 @@
+// Stands in for the header pioasm generates from hub75.pio, see pico/stdlib.h
+#pragma once
+
+#include "hardware/pio.h"
+
+static const pio_program_t hub75_row_program = {};
+static const pio_program_t hub75_row_inverted_program = {};
+static const pio_program_t hub75_row_chained_program = {};
+static const pio_program_t hub75_row_chained_inverted_program = {};
+static const pio_program_t hub75_row_chained_dual_program = {};
+static const pio_program_t hub75_row_chained_dual_inverted_program = {};
+static const pio_program_t hub75_data_rgb888_program = {};
+static const pio_program_t hub75_data_planes_program = {};
+
+static inline void hub75_row_program_init(PIO, uint, uint, uint, uint, uint) {}
+static inline void hub75_row_chained_program_init(PIO, uint, uint, uint, uint, uint) {}
+static inline void hub75_row_chained_dual_program_init(PIO, uint, uint, uint, uint, uint) {}
+static inline void hub75_data_rgb888_program_init(PIO, uint, uint, uint, uint) {}
+static inline void hub75_data_planes_program_init(PIO, uint, uint, uint, uint, uint) {}
+static inline void hub75_data_rgb888_set_shift(PIO, uint, uint) {}
+static inline void hub75_wait_tx_stall(PIO, uint) {}
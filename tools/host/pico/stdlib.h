@@ -0,0 +1,24 @@
+// Just enough of the Pico SDK for building Hub75 into the host tools, with no hardware behind it
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "pico/types.h"
+
+#define NUM_BANK0_GPIOS 30
+enum { GPIO_FUNC_SIO = 5 };
+
+static inline void gpio_init(uint) {}
+static inline void gpio_set_function(uint, int) {}
+static inline void gpio_set_dir(uint, bool) {}
+static inline void gpio_put(uint, bool) {}
+static inline void gpio_put_masked(uint32_t, uint32_t) {}
+static inline void sleep_us(uint64_t) {}
+static inline void tight_loop_contents() {}
+
+static inline uint32_t time_us_32() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
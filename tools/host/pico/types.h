@@ -0,0 +1,4 @@
+// Just enough of the Pico SDK for building frame_decoder.hpp into the host tools
+#pragma once
+
+typedef unsigned int uint;
@@ -0,0 +1,154 @@
+//
+//  qoi_frames.cpp
+//
+//  Host side of the "iq" topic: encodes raw RGB frames as QOI, and round-trips them through the
+//  panel's FrameDecoder to check it and to see what the compression gets on real content.
+//
+//  Build (from the repo root):
+//    c++ -std=c++17 -O2 -Itools/host -I. tools/qoi_frames.cpp -o qoi_frames
+//
+//  Frames are raw 24 bit RGB, one after the other, e.g. from
+//    ffmpeg -i clip.mp4 -vf scale=128:64 -f rawvideo -pix_fmt rgb24 frames.rgb
+//
+//    qoi_frames encode 128 64 frames.rgb out/frame     writes out/frame0000.qoi etc.
+//    qoi_frames test 128 64 [frames.rgb]               round trip, test patterns if no file, and
+//                                                      that rows the panel holds already are skipped
+//                                                      (the other formats of FrameDecoder: see
+//                                                      test_formats)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "host/frame_tool.hpp"
+
+static std::vector<uint8_t> qoi_encode(const uint8_t *rgb, uint w, uint h) {
+	std::vector<uint8_t> out = {'q', 'o', 'i', 'f',
+		(uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w,
+		(uint8_t)(h >> 24), (uint8_t)(h >> 16), (uint8_t)(h >> 8), (uint8_t)h,
+		3, 0};
+	// RGBA like the decoder's, so that an unused (transparent) slot never matches black
+	uint8_t index[64][4] = {};
+	uint8_t prev[3] = {0, 0, 0};
+	uint run = 0;
+	for (uint i = 0; i < w * h; i++) {
+		const uint8_t *px = rgb + i * 3;
+		if (px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2]) {
+			if (++run == 62) {
+				out.push_back(0xc0 | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+		if (run) {
+			out.push_back(0xc0 | (run - 1));
+			run = 0;
+		}
+		uint hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) & 63;
+		int dr = (int8_t)(px[0] - prev[0]);
+		int dg = (int8_t)(px[1] - prev[1]);
+		int db = (int8_t)(px[2] - prev[2]);
+		if (index[hash][0] == px[0] && index[hash][1] == px[1] && index[hash][2] == px[2] && index[hash][3] == 255) {
+			out.push_back(hash);
+		} else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+			out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+		} else if (dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+			out.push_back(0x80 | (dg + 32));
+			out.push_back((dr - dg + 8) << 4 | (db - dg + 8));
+		} else {
+			out.insert(out.end(), {0xfe, px[0], px[1], px[2]});
+		}
+		index[hash][0] = px[0];
+		index[hash][1] = px[1];
+		index[hash][2] = px[2];
+		index[hash][3] = 255;
+		prev[0] = px[0];
+		prev[1] = px[1];
+		prev[2] = px[2];
+	}
+	if (run) {
+		out.push_back(0xc0 | (run - 1));
+	}
+	out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+	return out;
+}
+
+static bool round_trip(FrameDecoder<FakePanel> &decoder, const std::vector<uint8_t> &qoi) {
+	decoder.begin(FrameDecoder<FakePanel>::Format::QOI, true);
+	return push_in_chunks(decoder, qoi);
+}
+
+static RGBFrames test_patterns(uint w, uint h) {
+	RGBFrames frames;
+	std::vector<uint8_t> f(w * h * 3);
+	for (uint i = 0; i < w * h * 3; i++) f[i] = 0;
+	frames.push_back(f);										// black
+	for (uint y = 0; y < h; y++) for (uint x = 0; x < w; x++) {	// gradients
+		uint8_t *p = &f[(y * w + x) * 3];
+		p[0] = x * 255 / w; p[1] = y * 255 / h; p[2] = 128;
+	}
+	frames.push_back(f);
+	for (uint i = 0; i < w * h * 3; i++) f[i] = 0;				// blocky "digits"
+	for (uint y = h / 4; y < h * 3 / 4; y++) for (uint x = 0; x < w; x++) {
+		if ((x / 4 + y / 4) % 3 == 0) { uint8_t *p = &f[(y * w + x) * 3]; p[0] = 255; p[1] = 160; }
+	}
+	frames.push_back(f);
+	for (uint i = 0; i < w * h * 3; i++) f[i] = rand();			// noise, the worst case
+	frames.push_back(f);
+	// Not starting black: the first black pixel hashes to an index slot that is still unused
+	static const uint8_t red[3] = {255, 0, 0}, black[3] = {0, 0, 0}, grey[3] = {1, 1, 1};
+	for (uint i = 0; i < w * h; i++) {
+		const uint8_t *c = i == 0 ? red : (i & 1) ? black : grey;
+		f[i * 3] = c[0]; f[i * 3 + 1] = c[1]; f[i * 3 + 2] = c[2];
+	}
+	frames.push_back(f);
+	return frames;
+}
+
+int main(int argc, char **argv) {
+	FrameTool tool;
+	if (int err = tool.parse(argc, argv, 0, "encode|test WIDTH HEIGHT [frames.rgb [out_prefix]]", test_patterns)) {
+		return err;
+	}
+	bool encode = tool.encode;
+	uint w = tool.width, h = tool.height;
+	const RGBFrames &frames = tool.frames;
+
+	FakePanel panel(w, h);
+	FrameDecoder<FakePanel> decoder(panel);
+	size_t total = 0;
+	uint failed = 0;
+	for (uint n = 0; n < frames.size(); n++) {
+		std::vector<uint8_t> qoi = qoi_encode(frames[n].data(), w, h);
+		total += qoi.size();
+		if (encode) {
+			if (!tool.write(n, "qoi", qoi)) {
+				return 1;
+			}
+			continue;
+		}
+		bool ok = round_trip(decoder, qoi) && panel.shown == frames[n];
+		failed += !ok;
+		printf("frame %u: %zu bytes, %.1f%% of i16, %.1f%% of i32%s\n", n, qoi.size(),
+			100.0 * qoi.size() / (w * h * 2), 100.0 * qoi.size() / (w * h * 4), round_trip_result(ok));
+	}
+	if (frames.size()) {
+		printf("%zu frames, average %zu bytes, %.1f%% of i16\n", frames.size(), total / frames.size(),
+			100.0 * total / frames.size() / (w * h * 2));
+	}
+	if (!encode && frames.size()) {
+		// the last frame again leaves every row as it is, and with one row changed only that one is converted
+		std::vector<uint8_t> frame = frames.back();
+		uint drawn = panel.drawn;
+		bool ok = round_trip(decoder, qoi_encode(frame.data(), w, h)) && panel.shown == frame && panel.drawn == drawn;
+		frame[(h / 2 * w) * 3] ^= 0xff;
+		drawn = panel.drawn;
+		ok = ok && round_trip(decoder, qoi_encode(frame.data(), w, h)) && panel.shown == frame && panel.drawn == drawn + 1;
+		failed += !ok;
+		printf("unchanged rows%s, %u rows converted, %u skipped\n", ok ? " skipped" : " SKIPPING FAILED",
+			panel.row_stats.converted, panel.row_stats.skipped);
+	}
+	return failed ? 1 : 0;
+}
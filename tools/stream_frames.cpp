@@ -0,0 +1,213 @@
+//
+//  stream_frames.cpp
+//
+//  Host side of the frame stream (see frame_stream.h): sends payloads as messages over a TCP
+//  connection (tcp_frames.h) or the USB serial port (usb_frames.h) to the panel, and a stand-in
+//  for the panel on a pseudo-terminal, running its parser.
+//
+//  Build (from the repo root):
+//    cc -O2 -I. -c frame_stream.c -o /tmp/frame_stream.o
+//    c++ -std=c++17 -O2 -I. tools/stream_frames.cpp /tmp/frame_stream.o -o stream_frames
+//
+//    stream_frames tcp HOST PORT TOPIC FPS file...
+//    stream_frames serial DEVICE TOPIC FPS file...
+//        sends each file as one message (a payload as for the MQTT topic, e.g. the output of
+//        qoi_frames or delta_frames), FPS per second at most, 0 for as fast as the panel takes them
+//    stream_frames pty
+//        prints the name of a pseudo-terminal to send to, and the messages that come in
+//
+//  e.g. "stream_frames pty" and "stream_frames serial /dev/pts/5 i16 0 frame*.bin"
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "frame_stream.h"
+
+static uint64_t now_us() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::vector<uint8_t> read_file(const char *name) {
+	std::vector<uint8_t> data;
+	FILE *f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	fclose(f);
+	return data;
+}
+
+static std::vector<uint8_t> message(const char *topic, const std::vector<uint8_t> &payload) {
+	size_t tl = strlen(topic);
+	size_t len = payload.size();
+	std::vector<uint8_t> msg = {'F', 'R', (uint8_t)tl};
+	msg.insert(msg.end(), topic, topic + tl);
+	msg.insert(msg.end(), {(uint8_t)(len >> 24), (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)len});
+	msg.insert(msg.end(), payload.begin(), payload.end());
+	return msg;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+static int connect_tcp(const char *host, const char *port) {
+	addrinfo hints = {}, *addr;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr) != 0) {
+		fprintf(stderr, "cannot resolve %s\n", host);
+		return -1;
+	}
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(s, addr->ai_addr, addr->ai_addrlen) != 0) {
+		perror("connect");
+		close(s);
+		s = -1;
+	} else {
+		int one = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	freeaddrinfo(addr);
+	return s;
+}
+
+static int open_serial(const char *device) {
+	int fd = open(device, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		perror(device);
+		return -1;
+	}
+	termios t;
+	if (tcgetattr(fd, &t) == 0) {
+		cfmakeraw(&t);
+		tcsetattr(fd, TCSANOW, &t);
+	}
+	return fd;
+}
+
+// The panel's side of it: frame_stream.c passing the messages on to this ingest ring stand-in
+static size_t message_bytes;
+
+extern "C" void ingest_begin(ingest_source_t, const char *topic) {
+	printf("message on \"%s\"", topic);
+	message_bytes = 0;
+}
+
+extern "C" bool ingest_push(ingest_source_t, const uint8_t *, uint16_t len, bool last) {
+	message_bytes += len;
+	if (last) {
+		printf(": %zu bytes\n", message_bytes);
+	}
+	return true;
+}
+
+extern "C" void ingest_abort(ingest_source_t) {
+	printf(": cut short after %zu bytes\n", message_bytes);
+}
+
+static int run_pty() {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		perror("pty");
+		return 1;
+	}
+	const char *name = ptsname(master);
+	// raw, like the USB serial port
+	int slave = open_serial(name);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	printf("%s\n", name);
+
+	frame_stream_t stream;
+	frame_stream_init(&stream, INGEST_USB);
+	uint8_t buf[256];
+	while (true) {
+		ssize_t n = read(master, buf, sizeof(buf));
+		if (n <= 0) {
+			// the sender closed its side
+			usleep(10000);
+			continue;
+		}
+		frame_stream_feed(&stream, buf, n);
+		if (stream.stats.skipped_bytes) {
+			printf("skipped %u bytes\n", stream.stats.skipped_bytes);
+			stream.stats.skipped_bytes = 0;
+		}
+	}
+	close(slave);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && strcmp(argv[1], "pty") == 0) {
+		return run_pty();
+	}
+	bool tcp = argc > 1 && strcmp(argv[1], "tcp") == 0;
+	int first = tcp ? 4 : 3;	// the topic
+	if ((!tcp && (argc < 2 || strcmp(argv[1], "serial") != 0)) || argc < first + 3) {
+		fprintf(stderr, "usage: %s tcp HOST PORT TOPIC FPS file...\n"
+						"       %s serial DEVICE TOPIC FPS file...\n"
+						"       %s pty\n", argv[0], argv[0], argv[0]);
+		return 2;
+	}
+	const char *topic = argv[first];
+	if (strlen(topic) == 0 || strlen(topic) > INGEST_TOPIC_MAX) {
+		fprintf(stderr, "bad topic\n");
+		return 2;
+	}
+	double fps = atof(argv[first + 1]);
+	int fd = tcp ? connect_tcp(argv[2], argv[3]) : open_serial(argv[2]);
+	if (fd < 0) {
+		return 1;
+	}
+
+	uint64_t start = now_us(), next = start;
+	size_t bytes = 0;
+	int count = 0;
+	for (int i = first + 2; i < argc; i++) {
+		std::vector<uint8_t> msg = message(topic, read_file(argv[i]));
+		if (!write_all(fd, msg.data(), msg.size())) {
+			perror("write");
+			return 1;
+		}
+		bytes += msg.size();
+		count++;
+		if (fps > 0) {
+			next += (uint64_t)(1e6 / fps);
+			uint64_t t = now_us();
+			if (next > t) {
+				usleep(next - t);
+			}
+		}
+	}
+	double secs = (now_us() - start) / 1e6;
+	printf("%d messages, %zu bytes in %.2f s: %.1f/s, %.0f KB/s\n", count, bytes, secs, count / secs, bytes / secs / 1024);
+	close(fd);
+	return 0;
+}
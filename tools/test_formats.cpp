@@ -0,0 +1,292 @@
+//
+//  test_formats.cpp
+//
+//  Runs FrameDecoder's formats into the panel's own conversion kernels (Hub75Panel on the
+//  tools/host SDK stubs, as bench_conversion does), and checks the Pixels the panel shows
+//  against what set_pixel() would have made of the expected colours. Each test runs at the
+//  configured size (config.h) and on a small panel of odd width.
+//
+//  Build (from the repo root):
+//    c++ -std=c++17 -O2 -Itools/host -I. tools/test_formats.cpp hub75.cpp -o test_formats
+//
+//    test_formats
+//        rectangles (r16/r32) on top of a frame, indexed frames (i8/i4) and repaint() after a
+//        palette change, planar YCbCr 4:2:0 (i12) against a floating point reference
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "config.h"
+#include "host/frame_tool.hpp"
+
+// PIXELS mode, so that the frame on display is the front Pixel buffer
+template <uint W, uint H>
+struct TestPanel : Hub75Panel<W, H, BIT_DEPTH, H / 2, Hub75::COLOR_ORDER::RGB, Hub75::SCAN_MODE::PIXELS> {
+	Pixel shown(uint x, uint y) { return this->front_buffer[this->buffer_offset(W, H, x, y)]; }
+};
+
+// Whether the panel shows `rgb`, as set_pixel() makes Pixels of it. With a tolerance, each
+// channel may be that much off before the gamma table.
+template <class Panel>
+static bool shows(Panel &panel, const std::vector<uint8_t> &rgb, int tolerance = 0) {
+	for (uint y = 0; y < panel.height; y++) {
+		for (uint x = 0; x < panel.width; x++) {
+			Pixel px = panel.shown(x, y);
+			for (uint c = 0; c < 3; c++) {
+				int v = rgb[(y * panel.width + x) * 3 + c];
+				uint got = (px >> (c * 10)) & 0x3ff;
+				if (got < panel.gamma[std::max(v - tolerance, 0)] || got > panel.gamma[std::min(v + tolerance, 255)]) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// The panel and a decoder for it, and the image it should show
+template <class Panel>
+struct Fixture {
+	Panel panel;
+	FrameDecoder<Panel> decoder{panel};
+	std::vector<uint8_t> expected;	// RGB
+	uint w = panel.width, h = panel.height;
+
+	Fixture() : expected(panel.width * panel.height * 3) {}
+
+	// Pushes a message into the decoder that has begun, and checks the panel against `expected`
+	bool round_trip(const std::vector<uint8_t> &msg, int tolerance = 0) {
+		return push_in_chunks(decoder, msg) && shows(panel, expected, tolerance);
+	}
+
+	// A whole i32 frame of `rgb`, which becomes what is expected
+	bool show_frame(const std::vector<uint8_t> &rgb) {
+		std::vector<uint8_t> msg;
+		for (uint i = 0; i < w * h; i++) {
+			msg.insert(msg.end(), {0, rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]});
+		}
+		expected = rgb;
+		decoder.begin(FrameDecoder<Panel>::Format::RGB888, true);
+		return round_trip(msg);
+	}
+
+	// Prints the result line of a test
+	bool report(const char *what, bool ok) {
+		printf("%ux%u %s%s\n", w, h, what, round_trip_result(ok));
+		return ok;
+	}
+};
+
+static std::vector<uint8_t> gradient(uint w, uint h) {
+	std::vector<uint8_t> f(w * h * 3);
+	for (uint y = 0; y < h; y++) for (uint x = 0; x < w; x++) {
+		uint8_t *p = &f[(y * w + x) * 3];
+		p[0] = x * 255 / w; p[1] = y * 255 / h; p[2] = 128;
+	}
+	return f;
+}
+
+static std::vector<uint8_t> noise(uint w, uint h) {
+	std::vector<uint8_t> f(w * h * 3);
+	for (auto &v : f) {
+		v = rand();
+	}
+	return f;
+}
+
+// An r16/r32 message with the rectangle at x, y of `rgb`, which it also puts into `expected`
+static std::vector<uint8_t> rect_message(const std::vector<uint8_t> &rgb, uint w, uint x, uint y, uint rw, uint rh,
+										 uint bits, std::vector<uint8_t> &expected) {
+	std::vector<uint8_t> msg = {(uint8_t)(x >> 8), (uint8_t)x, (uint8_t)(y >> 8), (uint8_t)y,
+		(uint8_t)(rw >> 8), (uint8_t)rw, (uint8_t)(rh >> 8), (uint8_t)rh};
+	for (uint j = y; j < y + rh; j++) {
+		for (uint i = x; i < x + rw; i++) {
+			const uint8_t *p = &rgb[(j * w + i) * 3];
+			uint8_t *e = &expected[(j * w + i) * 3];
+			if (bits == 16) {
+				uint col = (p[0] & 0xf8) << 8 | (p[1] & 0xfc) << 3 | p[2] >> 3;
+				msg.insert(msg.end(), {(uint8_t)(col >> 8), (uint8_t)col});
+				e[0] = p[0] & 0xf8; e[1] = p[1] & 0xfc; e[2] = p[2] & 0xf8;
+			} else {
+				msg.insert(msg.end(), {0, p[0], p[1], p[2]});
+				memcpy(e, p, 3);
+			}
+		}
+	}
+	return msg;
+}
+
+// r16/r32 on top of a frame: the header split across pushes, full and partial rows, the bounds
+// checks, and that rows drawn in part are converted again by the next whole frame
+template <class Panel>
+static bool test_rects(Fixture<Panel> &f) {
+	using Format = typename FrameDecoder<Panel>::Format;
+	uint w = f.w, h = f.h;
+	std::vector<uint8_t> base = gradient(w, h), src = noise(w, h);
+	bool ok = f.report("i32", f.show_frame(base));
+	struct { uint x, y, rw, rh, bits; size_t split; } rects[] = {
+		{w / 4, h / 4, w / 2, h / 2, 32, 5},	// header in single bytes, then the pixels
+		{w / 3, 1, w - w / 3, h - 1, 16, 3},	// to the edges
+		{0, h / 2, w, 2, 32, 0},				// whole rows
+		{w - 1, h - 1, 1, 1, 16, 8},
+	};
+	for (auto &r : rects) {
+		std::vector<uint8_t> msg = rect_message(src, w, r.x, r.y, r.rw, r.rh, r.bits, f.expected);
+		f.decoder.begin_rect(r.bits == 16 ? Format::RGB565 : Format::RGB888, true);
+		for (size_t i = 0; i < r.split; i++) {
+			f.decoder.push(&msg[i], 1);
+		}
+		char what[64];
+		snprintf(what, sizeof(what), "r%u %ux%u at %u,%u", r.bits, r.rw, r.rh, r.x, r.y);
+		ok &= f.report(what, f.round_trip(std::vector<uint8_t>(msg.begin() + r.split, msg.end())));
+	}
+	// outside of the canvas, or empty: nothing is shown
+	struct { uint x, y, rw, rh; } bad[] = {
+		{1, 0, w, 1}, {0, 1, 1, h}, {w, 0, 1, 1}, {0, h, 1, 1}, {0, 0, 0, 1}, {0, 0, 1, 0},
+	};
+	bool rejected = true;
+	for (auto &r : bad) {
+		std::vector<uint8_t> msg = {(uint8_t)(r.x >> 8), (uint8_t)r.x, (uint8_t)(r.y >> 8), (uint8_t)r.y,
+			(uint8_t)(r.rw >> 8), (uint8_t)r.rw, (uint8_t)(r.rh >> 8), (uint8_t)r.rh};
+		msg.resize(msg.size() + r.rw * r.rh * 4);
+		f.decoder.begin_rect(Format::RGB888, true);
+		rejected &= !push_in_chunks(f.decoder, msg) && shows(f.panel, f.expected);
+	}
+	ok &= f.report("rectangles outside of the canvas rejected", rejected);
+	// the rows the rectangles went into differ from base now, so it must be converted again
+	ok &= f.report("whole frame after rectangles", f.show_frame(base));
+	return ok;
+}
+
+// An i8/i4 frame of indices made up from x and y, which it also puts into `expected` with `palette`
+static std::vector<uint8_t> indexed_message(uint w, uint h, uint bits, const uint8_t (*palette)[3],
+											std::vector<uint8_t> &expected) {
+	uint row_bytes = bits == 8 ? w : (w + 1) / 2;
+	std::vector<uint8_t> msg(row_bytes * h, bits == 8 ? 0 : 0xff);	// i4: the unused nibble of an odd row set
+	for (uint y = 0; y < h; y++) {
+		for (uint x = 0; x < w; x++) {
+			uint index = (x * 7 + y * 3 + x * y) % (bits == 8 ? 256 : 16);
+			uint8_t *m = &msg[y * row_bytes + (bits == 8 ? x : x / 2)];
+			if (bits == 8) {
+				*m = index;
+			} else {
+				*m = x & 1 ? (*m & 0xf0) | index : (*m & 0x0f) | index << 4;
+			}
+			memcpy(&expected[(y * w + x) * 3], palette[index], 3);
+		}
+	}
+	return msg;
+}
+
+// i8 and i4 frames with Hub75::set_palette(), then a palette change as the "p" topic makes it:
+// set_palette() and repaint(). At an odd width the last nibble of each i4 row is unused.
+template <class Panel>
+static bool test_indexed(Fixture<Panel> &f) {
+	using Format = typename FrameDecoder<Panel>::Format;
+	uint w = f.w, h = f.h;
+	uint8_t palette[256][3], cycled[256][3];
+	for (uint i = 0; i < 256; i++) {
+		for (uint c = 0; c < 3; c++) {
+			palette[i][c] = rand();
+		}
+	}
+	for (uint i = 0; i < 256; i++) {
+		memcpy(cycled[i], palette[(i + 1) % 256], 3);	// like a colour cycling effect
+	}
+	bool ok = true;
+	for (uint bits : {8, 4}) {
+		Format format = bits == 8 ? Format::INDEXED8 : Format::INDEXED4;
+		f.panel.set_palette(0, palette[0], 256);
+		f.decoder.begin(format, true);
+		bool shown = f.round_trip(indexed_message(w, h, bits, palette, f.expected));
+		// the new palette on the frame the panel has
+		f.panel.set_palette(0, cycled[0], 256);
+		indexed_message(w, h, bits, cycled, f.expected);
+		bool repainted = f.decoder.repaint() && shows(f.panel, f.expected);
+		// the same indices again: they go into the buffer that has them with the old palette, so
+		// no row may be skipped as unchanged
+		f.decoder.begin(format, true);
+		bool again = f.round_trip(indexed_message(w, h, bits, cycled, f.expected));
+		char what[64];
+		snprintf(what, sizeof(what), "i%u", bits);
+		ok &= f.report(what, shown);
+		snprintf(what, sizeof(what), "i%u repaint() after set_palette()", bits);
+		ok &= f.report(what, repainted);
+		snprintf(what, sizeof(what), "i%u after a palette change", bits);
+		ok &= f.report(what, again);
+	}
+	// once another frame replaced the indexed one there's nothing to repaint
+	bool replaced = f.show_frame(gradient(w, h)) && !f.decoder.repaint() && shows(f.panel, f.expected);
+	ok &= f.report("no repaint() after an i32 frame", replaced);
+	return ok;
+}
+
+// BT.601 limited range in floating point, what the panel's fixed point conversion has to come
+// close to
+static std::vector<uint8_t> ycbcr_reference(const std::vector<uint8_t> &planes, uint w, uint h) {
+	uint cw = (w + 1) / 2, chroma = cw * ((h + 1) / 2);
+	std::vector<uint8_t> rgb(w * h * 3);
+	for (uint y = 0; y < h; y++) {
+		for (uint x = 0; x < w; x++) {
+			double l = 1.164 * (planes[y * w + x] - 16);
+			double cb = planes[w * h + y / 2 * cw + x / 2] - 128.0;
+			double cr = planes[w * h + chroma + y / 2 * cw + x / 2] - 128.0;
+			double c[3] = {l + 1.596 * cr, l - 0.392 * cb - 0.813 * cr, l + 2.017 * cb};
+			for (uint i = 0; i < 3; i++) {
+				rgb[(y * w + x) * 3 + i] = (uint8_t)fmin(fmax(round(c[i]), 0), 255);
+			}
+		}
+	}
+	return rgb;
+}
+
+// i12 through Hub75's ycbcr_row_to_buffer(): random planes against the reference, within 2 per
+// channel, then the same planes (no row converted) and one chroma sample changed (only the pair
+// of rows it belongs to converted). The panel's height is even, an odd width gives a chroma
+// column for the last luma column alone.
+template <class Panel>
+static bool test_ycbcr(Fixture<Panel> &f) {
+	using Format = typename FrameDecoder<Panel>::Format;
+	uint w = f.w, h = f.h;
+	uint cw = (w + 1) / 2, chroma = cw * ((h + 1) / 2);
+	std::vector<uint8_t> planes(w * h + 2 * chroma);
+	for (auto &p : planes) {
+		p = rand();
+	}
+	f.expected = ycbcr_reference(planes, w, h);
+	f.decoder.begin(Format::YCBCR420, true);
+	bool ok = f.report("i12", f.round_trip(planes, 2));
+	// into the other Pixel buffer as well, then both have it
+	f.decoder.begin(Format::YCBCR420, true);
+	bool skipped = f.round_trip(planes, 2);
+	uint converted = f.panel.row_stats.converted;
+	f.decoder.begin(Format::YCBCR420, true);
+	skipped = skipped && f.round_trip(planes, 2) && f.panel.row_stats.converted == converted;
+	ok &= f.report("i12 unchanged rows skipped", skipped);
+	planes[w * h + chroma + (h - 1) / 2 * cw] ^= 0x55;		// Cr of the last pair of rows
+	f.expected = ycbcr_reference(planes, w, h);
+	converted = f.panel.row_stats.converted;
+	f.decoder.begin(Format::YCBCR420, true);
+	bool pair = f.round_trip(planes, 2) && f.panel.row_stats.converted == converted + 2;
+	ok &= f.report("i12 one chroma sample changed", pair);
+	return ok;
+}
+
+template <class Panel>
+static uint run_tests() {
+	static Fixture<Panel> f;	// the panel's buffers are static anyway
+	uint failed = 0;
+	failed += !test_rects(f);
+	failed += !test_indexed(f);
+	failed += !test_ycbcr(f);
+	return failed;
+}
+
+int main() {
+	uint failed = run_tests<TestPanel<WIDTH, HEIGHT>>() + run_tests<TestPanel<13, 6>>();
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+//
+//  udp_frames.cpp
+//
+//  Host side of the UDP frame transport (see udp_frames.h): sends payloads as fragmented
+//  frames, and a stand-in for the panel that reassembles them with its frame_fragments.c, to
+//  try it on loopback.
+//
+//  Build (from the repo root):
+//    cc -O2 -I. -c frame_fragments.c -o /tmp/frame_fragments.o
+//    c++ -std=c++17 -O2 -I. tools/udp_frames.cpp /tmp/frame_fragments.o -o udp_frames
+//
+//    udp_frames send HOST PORT TOPIC FPS file... [-s FRAGMENT_SIZE] [-l LOSE_EVERY]
+//        sends each file as one frame (a payload as for the MQTT topic, e.g. the output of
+//        qoi_frames or delta_frames), FPS frames per second; -l drops every n-th fragment
+//    udp_frames listen PORT
+//        prints what the panel would make of the received frames
+//
+//  e.g. "udp_frames listen 7075" and "udp_frames send 127.0.0.1 7075 i16 30 frame*.bin -l 50"
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "config.h"
+#include "frame_fragments.h"
+
+static uint64_t now_us() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::vector<uint8_t> read_file(const char *name) {
+	std::vector<uint8_t> data;
+	FILE *f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	fclose(f);
+	return data;
+}
+
+static int send_frames(int argc, char **argv) {
+	if (argc < 7) {
+		fprintf(stderr, "usage: %s send HOST PORT TOPIC FPS file... [-s FRAGMENT_SIZE] [-l LOSE_EVERY]\n", argv[0]);
+		return 2;
+	}
+	const char *topic = argv[4];
+	double fps = atof(argv[5]);
+	size_t fragment_size = 1400;
+	uint lose_every = 0;
+	std::vector<const char *> files;
+	for (int i = 6; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			fragment_size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			lose_every = atoi(argv[++i]);
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+	size_t topic_len = strlen(topic);
+	if (topic_len == 0 || topic_len > INGEST_TOPIC_MAX || fragment_size <= FRAME_FRAGMENT_HEADER + topic_len) {
+		fprintf(stderr, "bad topic or fragment size\n");
+		return 2;
+	}
+
+	addrinfo hints = {}, *addr;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(argv[2], argv[3], &hints, &addr) != 0) {
+		fprintf(stderr, "cannot resolve %s\n", argv[2]);
+		return 1;
+	}
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+	uint16_t frame_id = (uint16_t)now_us();
+	uint sent = 0, lost = 0;
+	uint64_t next = now_us();
+	for (const char *name : files) {
+		std::vector<uint8_t> payload = read_file(name);
+		// fragment 0 also carries the topic
+		size_t first = fragment_size - FRAME_FRAGMENT_HEADER - topic_len;
+		size_t rest = fragment_size - FRAME_FRAGMENT_HEADER;
+		size_t count = payload.size() <= first ? 1 : 1 + (payload.size() - first + rest - 1) / rest;
+		if (count > 0xffff) {
+			fprintf(stderr, "%s: too large\n", name);
+			return 1;
+		}
+		size_t pos = 0;
+		for (size_t index = 0; index < count; index++) {
+			size_t tl = index == 0 ? topic_len : 0;
+			size_t n = std::min(payload.size() - pos, index == 0 ? first : rest);
+			std::vector<uint8_t> packet = {
+				(uint8_t)(frame_id >> 8), (uint8_t)frame_id,
+				(uint8_t)(index >> 8), (uint8_t)index,
+				(uint8_t)(count >> 8), (uint8_t)count,
+				(uint8_t)tl};
+			packet.insert(packet.end(), topic, topic + tl);
+			packet.insert(packet.end(), payload.begin() + pos, payload.begin() + pos + n);
+			pos += n;
+			sent++;
+			if (lose_every && sent % lose_every == 0) {
+				lost++;
+				continue;
+			}
+			sendto(s, packet.data(), packet.size(), 0, addr->ai_addr, addr->ai_addrlen);
+		}
+		frame_id++;
+		if (fps > 0) {
+			next += (uint64_t)(1e6 / fps);
+			uint64_t t = now_us();
+			if (next > t) {
+				usleep(next - t);
+			}
+		}
+	}
+	printf("%zu frames, %u fragments, %u of them dropped on purpose\n", files.size(), sent, lost);
+	freeaddrinfo(addr);
+	close(s);
+	return 0;
+}
+
+// The panel's side of it: frame_fragments.c passing the frames on to this ingest ring stand-in
+static char received_topic[INGEST_TOPIC_MAX + 1];
+static size_t frame_bytes;
+static uint64_t frame_started;
+
+extern "C" void ingest_begin(ingest_source_t, const char *topic) {
+	snprintf(received_topic, sizeof(received_topic), "%s", topic);
+	frame_bytes = 0;
+	frame_started = now_us();
+}
+
+extern "C" bool ingest_push(ingest_source_t, const uint8_t *, uint16_t len, bool last) {
+	frame_bytes += len;
+	if (last) {
+		printf("frame on \"%s\": %zu bytes, %.2f ms\n", received_topic, frame_bytes, (now_us() - frame_started) / 1000.0);
+	}
+	return true;
+}
+
+extern "C" void ingest_abort(ingest_source_t) {
+	printf("frame on \"%s\" dropped after %zu bytes\n", received_topic, frame_bytes);
+}
+
+static int listen_frames(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s listen PORT\n", argv[0]);
+		return 2;
+	}
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in local = {};
+	local.sin_family = AF_INET;
+	local.sin_port = htons(atoi(argv[2]));
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(s, (sockaddr *)&local, sizeof(local)) != 0) {
+		perror("bind");
+		return 1;
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	timeval tv = {0, 10000};
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	frame_fragments_t fragments;
+	frame_fragments_init(&fragments, INGEST_UDP);
+	frame_fragments_stats_t shown = {};
+	uint8_t packet[65536];
+	while (true) {
+		ssize_t len = recv(s, packet, sizeof(packet), 0);
+		// udp_frames.c has a lwIP timer for it
+		if (fragments.receiving && fragments.fragment_count > 1 && now_us() - frame_started > UDP_FRAME_TIMEOUT_MS * 1000) {
+			printf("timed out after %u of %u fragments: ", fragments.next_index, fragments.fragment_count);
+			frame_fragments_timeout(&fragments);
+		}
+		if (len < 0) {
+			continue;
+		}
+		// one piece here, a chain of pbufs on the panel
+		int offset = frame_fragments_begin(&fragments, packet, len, len);
+		if (offset >= 0) {
+			frame_fragments_payload(&fragments, packet + offset, len - offset);
+		}
+		const frame_fragments_stats_t &now = fragments.stats;
+		if (now.frames != shown.frames || now.frames_dropped != shown.frames_dropped) {
+			printf("  %u received, %u dropped, %u stray fragments\n", now.frames, now.frames_dropped, now.fragments_dropped);
+			shown = now;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && strcmp(argv[1], "send") == 0) {
+		return send_frames(argc, argv);
+	} else if (argc > 1 && strcmp(argv[1], "listen") == 0) {
+		return listen_frames(argc, argv);
+	}
+	fprintf(stderr, "usage: %s send|listen ...\n", argv[0]);
+	return 2;
+}
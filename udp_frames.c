@@ -0,0 +1,70 @@
+//
+//  udp_frames.c
+//
+//  The UDP side of the fragments (see frame_fragments.h): datagrams in, and the timeout.
+//  Everything here runs in the lwIP context, like the MQTT callbacks.
+//
+
+#include "udp_frames.h"
+
+#include <string.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/udp.h"
+#include "lwip/timeouts.h"
+
+static struct udp_pcb *pcb;
+static frame_fragments_t fragments;
+
+static void frame_timeout (__attribute__((unused)) void *arg) {
+	frame_fragments_timeout (&fragments);
+}
+
+static void udp_frames_recv (__attribute__((unused)) void *arg, __attribute__((unused)) struct udp_pcb *upcb,
+							 struct pbuf *p, __attribute__((unused)) const ip_addr_t *addr,
+							 __attribute__((unused)) u16_t port) {
+	bool timing = fragments.receiving && fragments.fragment_count > 1;
+	uint8_t start[FRAME_FRAGMENT_HEADER + INGEST_TOPIC_MAX];
+	uint16_t len = pbuf_copy_partial (p, start, sizeof(start), 0);
+	int offset = frame_fragments_begin (&fragments, start, len, p->tot_len);
+	for (struct pbuf *q = p; q != NULL && offset >= 0; q = q->next) {
+		if (offset >= q->len) {
+			offset -= q->len;
+			continue;
+		}
+		frame_fragments_payload (&fragments, (const uint8_t *)q->payload + offset, q->len - offset);
+		offset = 0;
+	}
+	pbuf_free (p);
+
+	// the timeout runs from the first fragment of a frame to its end
+	if (timing && (!fragments.receiving || fragments.started)) {
+		sys_untimeout (frame_timeout, NULL);
+	}
+	if (fragments.started && fragments.receiving) {
+		sys_timeout (UDP_FRAME_TIMEOUT_MS, frame_timeout, NULL);
+	}
+}
+
+bool udp_frames_init (void) {
+	cyw43_arch_lwip_begin();
+	frame_fragments_init (&fragments, INGEST_UDP);
+	pcb = udp_new();
+	bool ok = pcb != NULL && udp_bind (pcb, IP_ANY_TYPE, UDP_FRAME_PORT) == ERR_OK;
+	if (ok) {
+		udp_recv (pcb, udp_frames_recv, NULL);
+	} else if (pcb != NULL) {
+		udp_remove (pcb);
+		pcb = NULL;
+	}
+	cyw43_arch_lwip_end();
+	return ok;
+}
+
+void udp_frames_read_stats (frame_fragments_stats_t *s, bool reset) {
+	cyw43_arch_lwip_begin();
+	*s = fragments.stats;
+	if (reset) {
+		memset (&fragments.stats, 0, sizeof(fragments.stats));
+	}
+	cyw43_arch_lwip_end();
+}
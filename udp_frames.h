@@ -0,0 +1,31 @@
+//
+//  udp_frames.h
+//
+//  Frames sent straight to the board over UDP, bypassing the broker (MQTT stays for control).
+//  A message is split into datagrams as in frame_fragments.h. The fragments are passed on to the
+//  ingest ring as they come in; a frame with a missing or out of order fragment, or one that
+//  isn't complete within UDP_FRAME_TIMEOUT_MS, is dropped.
+//  The decoder is shared: a frame that comes in while one from another transport is being
+//  decoded is dropped (see process_data()).
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "frame_fragments.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts listening on UDP_FRAME_PORT
+bool udp_frames_init (void);
+
+void udp_frames_read_stats (frame_fragments_stats_t *stats, bool reset);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,70 @@
+//
+//  usb_frames.c
+//
+//  The reading runs as an async_context worker in the lwIP context, so that the ingest ring
+//  keeps a single producer context. It is woken by stdio when data comes in, and by the
+//  consumer when it made room in the ring. Data is only taken out of the USB buffer if it fits
+//  into the ring, else the host waits.
+//
+
+#include "usb_frames.h"
+#include "ingest.h"
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "pico/cyw43_arch.h"
+
+#define READ_SIZE 256		// the CDC receive buffer
+#define READS_PER_RUN 16	// before letting lwIP in again
+
+static frame_stream_t stream;
+
+static void usb_read (async_context_t *context, async_when_pending_worker_t *worker);
+
+static async_when_pending_worker_t read_worker = {.do_work = usb_read};
+
+// from the USB interrupt, or the consumer
+static void wake_reader (__attribute__((unused)) void *param) {
+	async_context_set_work_pending (cyw43_arch_async_context(), &read_worker);
+}
+
+static void usb_consumed (__attribute__((unused)) uint16_t len) {
+	wake_reader (NULL);
+}
+
+static void usb_read (async_context_t *context, async_when_pending_worker_t *worker) {
+	uint8_t buf[READ_SIZE];
+	for (int i = 0; i < READS_PER_RUN; i++) {
+		if (ingest_room() < sizeof(buf)) {
+			// the consumer wakes us up again
+			return;
+		}
+		int n = stdio_usb.in_chars ((char *)buf, sizeof(buf));
+		if (n <= 0) {
+			return;
+		}
+		frame_stream_feed (&stream, buf, n);
+	}
+	async_context_set_work_pending (context, worker);
+}
+
+void usb_frames_init (void) {
+	frame_stream_init (&stream, INGEST_USB);
+	ingest_set_consumed_callback (INGEST_USB, usb_consumed);
+	cyw43_arch_lwip_begin();
+	async_context_add_when_pending_worker (cyw43_arch_async_context(), &read_worker);
+	cyw43_arch_lwip_end();
+	stdio_set_chars_available_callback (wake_reader, NULL);
+	// anything that came before
+	wake_reader (NULL);
+}
+
+void usb_frames_read_stats (frame_stream_stats_t *s, bool reset) {
+	cyw43_arch_lwip_begin();
+	*s = stream.stats;
+	if (reset) {
+		memset (&stream.stats, 0, sizeof(stream.stats));
+	}
+	cyw43_arch_lwip_end();
+}
@@ -0,0 +1,30 @@
+//
+//  usb_frames.h
+//
+//  Messages over the USB serial port (CDC), as described in frame_stream.h, for when the panel
+//  is wired to the sender. The port stays in use for printf(); nothing else may read from
+//  stdio. USB flow control throttles the sender while the ingest ring is full, so nothing gets
+//  dropped. The decoder is shared: a frame that comes in while one from another transport is
+//  being decoded is dropped (see process_data()).
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "frame_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts reading from USB, needs stdio_init_all() and the WiFi (for the lwIP context) first
+void usb_frames_init (void);
+
+void usb_frames_read_stats (frame_stream_stats_t *stats, bool reset);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif